@@ -25,13 +25,15 @@
 
 #include "succinct_dbg.h"
 #include "assembly_algorithms.h"
+#include "unitig_graph.h"
 #include "timer.h"
 #include "options_description.h"
 #include "mem_file_checker-inl.h"
+#include "megahit_core.h"
 
 using std::string;
 
-struct AssemblerOptions {
+static struct AssemblerOptions {
     string sdbg_name;
     string output_prefix;
     string final_contig_file_name;
@@ -41,6 +43,7 @@ struct AssemblerOptions {
     int min_final_contig_len;
     bool is_final_round;
     bool no_bubble;
+    bool simplify_unitig_graph;
     double bubble_remove_ratio;
     bool remove_low_local;
     double low_local_ratio;
@@ -52,6 +55,7 @@ struct AssemblerOptions {
         max_tip_len = -1;
         min_final_contig_len = 200;
         no_bubble = false;
+        simplify_unitig_graph = false;
         bubble_remove_ratio = 1;
         remove_low_local = false;
         low_local_ratio = 0.2;
@@ -80,7 +84,7 @@ struct AssemblerOptions {
 
 } options;
 
-void ParseOption(int argc, char *argv[]) {
+static void ParseOption(int argc, char *argv[]) {
     OptionsDescription desc;
 
     desc.AddOption("sdbg_name", "s", options.sdbg_name, "succinct de Bruijn graph name");
@@ -89,6 +93,7 @@ void ParseOption(int argc, char *argv[]) {
     desc.AddOption("max_tip_len", "", options.max_tip_len, "max length for tips to be removed. -1 for 2k");
     desc.AddOption("min_final_contig_len", "", options.min_final_contig_len, "min length to output a final contig");
     desc.AddOption("no_bubble", "", options.no_bubble, "do not remove bubbles");
+    desc.AddOption("simplify_unitig_graph", "", options.simplify_unitig_graph, "remove tips and bubbles on the unitig graph instead of the succinct de Bruijn graph");
     desc.AddOption("bubble_remove_ratio", "", options.bubble_remove_ratio, "bubbles with multiplicities lower than this ratio times to highest of its group will be removed");
     desc.AddOption("remove_low_local", "", options.remove_low_local, "remove low local depth contigs progressively");
     desc.AddOption("low_local_ratio", "", options.low_local_ratio, "ratio to define low depth contigs");
@@ -108,11 +113,12 @@ void ParseOption(int argc, char *argv[]) {
     }
 }
 
-int main(int argc, char **argv) {
+int main_assembler(int argc, char **argv) {
     // set stdout line buffered
     setvbuf(stdout, NULL, _IONBF, 0);
     setvbuf(stderr, NULL, _IONBF, 0);
 
+    options = AssemblerOptions();
     ParseOption(argc, argv);
 
     SuccinctDBG dbg;  
@@ -141,7 +147,7 @@ int main(int argc, char **argv) {
         }
     }
 
-    if (options.max_tip_len > 0) { // tips removal
+    if (options.max_tip_len > 0 && !options.simplify_unitig_graph) { // tips removal
         timer.reset();
         timer.start();
         assembly_algorithms::RemoveTips(dbg, options.max_tip_len, options.min_final_contig_len);
@@ -149,7 +155,7 @@ int main(int argc, char **argv) {
         printf("Tips removal done! Time elapsed(sec): %lf\n", timer.elapsed());
     }
 
-    if (!options.no_bubble) { // merge bubbles
+    if (!options.no_bubble && !options.simplify_unitig_graph) { // merge bubbles
         timer.reset();
         timer.start();
         int64_t num_bubbles = assembly_algorithms::PopBubbles(dbg, dbg.kmer_k + 2, options.bubble_remove_ratio);
@@ -157,6 +163,33 @@ int main(int argc, char **argv) {
         printf("Number of bubbles: %lld. Time elapsed: %lf\n", (long long)num_bubbles, timer.elapsed());
     }
 
+    UnitigGraph unitig_graph(&dbg);
+    { // build the unitig graph
+        timer.reset();
+        timer.start();
+        unitig_graph.InitFromSdBG();
+        timer.stop();
+        printf("unitig graph size: %u, time for building: %lf\n", unitig_graph.size(), timer.elapsed());
+    }
+
+    if (options.simplify_unitig_graph) {
+        if (options.max_tip_len > 0) { // tips removal
+            timer.reset();
+            timer.start();
+            assembly_algorithms::RemoveTips(unitig_graph, options.max_tip_len, options.min_final_contig_len);
+            timer.stop();
+            printf("Tips removal done! Time elapsed(sec): %lf\n", timer.elapsed());
+        }
+
+        if (!options.no_bubble) { // merge bubbles
+            timer.reset();
+            timer.start();
+            int64_t num_bubbles = assembly_algorithms::PopBubbles(unitig_graph, dbg.kmer_k + 2, options.bubble_remove_ratio);
+            timer.stop();
+            printf("Number of bubbles: %lld. Time elapsed: %lf\n", (long long)num_bubbles, timer.elapsed());
+        }
+    }
+
 
     FILE *out_contig_file = OpenFileAndCheck(options.contig_file().c_str(), "w");
     FILE *out_multi_file = OpenFileAndCheck(options.multi_file().c_str(), "wb");
@@ -178,7 +211,7 @@ int main(int argc, char **argv) {
 
             // FILE *out_final_contig_file = NULL; // uncomment to avoid output final contigs
             assembly_algorithms::RemoveLowLocalAndOutputChanged(
-                dbg, out_contig_file, 
+                unitig_graph, out_contig_file, 
                 out_multi_file, 
                 out_final_contig_file,
                 out_addi_contig_file,
@@ -192,7 +225,7 @@ int main(int argc, char **argv) {
             fclose(out_addi_multi_file);
         } else {
             assembly_algorithms::RemoveLowLocalAndOutputFinal(
-                dbg, 
+                unitig_graph, 
                 out_final_contig_file, 
                 2, 
                 dbg.kmer_k * 2, 
@@ -208,14 +241,14 @@ int main(int argc, char **argv) {
         if (!options.is_final_round) {
             // FILE *out_final_contig_file = NULL; // uncomment to avoid output final contigs
             assembly_algorithms::AssembleFromUnitigGraph(
-                dbg, 
+                unitig_graph, 
                 out_contig_file, 
                 out_multi_file,
                 out_final_contig_file,
                 options.min_final_contig_len);
         } else {
             assembly_algorithms::AssembleFinalFromUnitigGraph(
-                dbg, 
+                unitig_graph, 
                 out_final_contig_file, 
                 options.min_final_contig_len);
         }
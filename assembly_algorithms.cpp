@@ -60,65 +60,118 @@ int64_t PrevSimplePathNode(SuccinctDBG &dbg, int64_t cur_node) {
     }
 }
 
-int64_t Trim(SuccinctDBG &dbg, int len, int min_final_contig_len) {
-    int64_t number_tips = 0;
-    omp_lock_t path_lock;
-    omp_init_lock(&path_lock);
-    marked.reset(dbg.size);
+// a dead-end node from which tips are searched
+// dir 0: outdegree zero, search backward; dir 1: indegree zero, search forward
+struct TipCandidate {
+    int64_t node;
+    int64_t stop_node; // the node with multiple in/outgoings blocking the last search, -1 if none
+    int dir;
+
+    TipCandidate(int64_t node = -1, int dir = 0): node(node), stop_node(-1), dir(dir) {}
+};
+
+enum TipSearchResult {
+    kIsTip,
+    kNotTip, // the dead-end path is an isolated long contig, never a tip
+    kTooLong, // the dead-end path is not shorter than len, search again with larger len
+    kBlocked, // the dead-end path ends at a node which stop_node; search again if stop_node changes
+};
+
+// search the dead-end path of a candidate, the path is stored in path[0...path_len-1]
+// if it is a tip, attach_node is the node it is attached to, -1 if the path is isolated
+static TipSearchResult SearchTip(SuccinctDBG &dbg, TipCandidate &candidate, int len, int min_final_contig_len,
+                                 int64_t *path, int &path_len, int64_t &attach_node) {
+    int64_t cur_node = candidate.node;
+    path[0] = cur_node;
+    path_len = 1;
+    attach_node = -1;
+    candidate.stop_node = -1;
+
+    for (int i = 1; i < len; ++i) {
+        int64_t next_node = candidate.dir == 0 ? dbg.UniqueIncoming(cur_node) : dbg.UniqueOutgoing(cur_node);
+        if (next_node == -1) {
+            if (candidate.dir == 0 ? dbg.IndegreeZero(cur_node) : dbg.OutdegreeZero(cur_node)) {
+                return i + dbg.kmer_k - 1 < min_final_contig_len ? kIsTip : kNotTip;
+            } else {
+                candidate.stop_node = dbg.GetLastIndex(cur_node);
+                return kBlocked;
+            }
+        } else if ((candidate.dir == 0 ? dbg.UniqueOutgoing(next_node) : dbg.UniqueIncoming(next_node)) == -1) {
+            attach_node = dbg.GetLastIndex(next_node);
+            return kIsTip;
+        } else {
+            path[path_len++] = next_node;
+            cur_node = next_node;
+        }
+    }
+    return kTooLong;
+}
+
+// seed scan: collect all dead-end nodes of the graph
+static void CollectTipCandidates(SuccinctDBG &dbg, vector<TipCandidate> &candidates) {
+    int num_threads = omp_get_max_threads();
+    vector<vector<TipCandidate> > thread_candidates(num_threads);
 
-#pragma omp parallel for reduction(+:number_tips)  
+#pragma omp parallel for schedule(static)
     for (int64_t node_idx = 0; node_idx < dbg.size; ++node_idx) {
-        if (dbg.IsValidNode(node_idx) && !marked.get(node_idx) && dbg.IsLast(node_idx) && dbg.OutdegreeZero(node_idx)) {
-            vector<int64_t> path = {node_idx};
-            int64_t prev_node;
-            int64_t cur_node = node_idx;
-            bool is_tip = false;
-            for (int i = 1; i < len; ++i) {
-                prev_node = dbg.UniqueIncoming(cur_node);
-                if (prev_node == -1) {
-                    is_tip = dbg.IndegreeZero(cur_node) && (i + dbg.kmer_k - 1 < min_final_contig_len);
-                    break;
-                } else if (dbg.UniqueOutgoing(prev_node) == -1) {
-                    is_tip = true;
-                    break;
-                } else {
-                    path.push_back(prev_node);
-                    cur_node = prev_node;
-                }
+        if (dbg.IsValidNode(node_idx) && dbg.IsLast(node_idx)) {
+            vector<TipCandidate> &local = thread_candidates[omp_get_thread_num()];
+            if (dbg.OutdegreeZero(node_idx)) {
+                local.push_back(TipCandidate(node_idx, 0));
             }
-
-            if (is_tip) {
-                for (unsigned i = 0; i < path.size(); ++i) {
-                    MarkNode(dbg, path[i]);
-                }
-                ++number_tips;
+            if (dbg.IndegreeZero(node_idx)) {
+                local.push_back(TipCandidate(node_idx, 1));
             }
         }
     }
 
+    candidates.clear();
+    for (int t = 0; t < num_threads; ++t) {
+        candidates.insert(candidates.end(), thread_candidates[t].begin(), thread_candidates[t].end());
+    }
+}
+
+// remove all tips shorter than len among the candidates against the current graph,
+// then replace the candidates with those which may still become tips: the unresolved ones,
+// the blocked ones whose stop node was touched, and the new dead ends created by the removal
+static int64_t TrimCandidates(SuccinctDBG &dbg, int len, int min_final_contig_len, vector<TipCandidate> &candidates) {
+    int64_t number_tips = 0;
+    int num_threads = omp_get_max_threads();
+    marked.reset(dbg.size);
+
+    vector<int64_t> path_buffer((size_t)num_threads * len);
+    vector<vector<int64_t> > removed_nodes(num_threads);
+    vector<vector<int64_t> > attach_nodes[2] = {vector<vector<int64_t> >(num_threads), vector<vector<int64_t> >(num_threads)};
+    vector<uint8_t> result(candidates.size(), kTooLong);
+
+    for (int dir = 0; dir < 2; ++dir) {
 #pragma omp parallel for reduction(+:number_tips)
-    for (int64_t node_idx = 0; node_idx < dbg.size; ++node_idx) {
-        if (dbg.IsValidNode(node_idx) && dbg.IsLast(node_idx) && !marked.get(node_idx) && dbg.IndegreeZero(node_idx)) {
-            vector<int64_t> path = {node_idx};
-            int64_t next_node;
-            int64_t cur_node = node_idx;
-            bool is_tip = false;
-            for (int i = 1; i < len; ++i) {
-                next_node = dbg.UniqueOutgoing(cur_node);
-                if (next_node == -1) {
-                    is_tip = dbg.OutdegreeZero(cur_node) && (i + dbg.kmer_k - 1 < min_final_contig_len);
-                    break;
-                } else if (dbg.UniqueIncoming(next_node) == -1) {
-                    is_tip = true;
-                } else {
-                    path.push_back(next_node);
-                    cur_node = next_node;
-                }
+        for (size_t i = 0; i < candidates.size(); ++i) {
+            TipCandidate &candidate = candidates[i];
+            if (candidate.dir != dir) { continue; }
+            if (!dbg.IsValidNode(candidate.node) || marked.get(candidate.node)) {
+                result[i] = kNotTip;
+                continue;
             }
+            if (candidate.stop_node != -1) {
+                // blocked in the previous round and its stop node is not touched
+                result[i] = kBlocked;
+                continue;
+            }
+
+            int thread_id = omp_get_thread_num();
+            int64_t *path = &path_buffer[(size_t)thread_id * len];
+            int path_len;
+            int64_t attach_node;
+            result[i] = SearchTip(dbg, candidate, len, min_final_contig_len, path, path_len, attach_node);
 
-            if (is_tip) {
-                for (unsigned i = 0; i < path.size(); ++i) {
-                    MarkNode(dbg, path[i]);
+            if (result[i] == kIsTip) {
+                for (int j = 0; j < path_len; ++j) {
+                    MarkNode(dbg, path[j]);
+                    removed_nodes[thread_id].push_back(path[j]);
+                }
+                if (attach_node != -1) {
+                    attach_nodes[dir][thread_id].push_back(attach_node);
                 }
                 ++number_tips;
             }
@@ -126,41 +179,116 @@ int64_t Trim(SuccinctDBG &dbg, int len, int min_final_contig_len) {
     }
 
 #pragma omp parallel for
-    for (int64_t node_idx = 0; node_idx < dbg.size; ++node_idx) {
-        if (marked.get(node_idx)) {
-            dbg.SetInvalid(node_idx);
+    for (int t = 0; t < num_threads; ++t) {
+        for (size_t i = 0; i < removed_nodes[t].size(); ++i) {
+            dbg.SetInvalid(removed_nodes[t][i]);
+        }
+    }
+
+    // nodes whose in/outgoings are changed
+    vector<int64_t> touched[2];
+    for (int dir = 0; dir < 2; ++dir) {
+        for (int t = 0; t < num_threads; ++t) {
+            touched[dir].insert(touched[dir].end(), attach_nodes[dir][t].begin(), attach_nodes[dir][t].end());
+        }
+        std::sort(touched[dir].begin(), touched[dir].end());
+        touched[dir].erase(std::unique(touched[dir].begin(), touched[dir].end()), touched[dir].end());
+    }
+
+    unsigned num_remained = 0;
+    for (size_t i = 0; i < candidates.size(); ++i) {
+        if (result[i] == kIsTip || result[i] == kNotTip) {
+            continue;
+        }
+        if (result[i] == kBlocked && 
+            !std::binary_search(touched[0].begin(), touched[0].end(), candidates[i].stop_node) &&
+            !std::binary_search(touched[1].begin(), touched[1].end(), candidates[i].stop_node)) {
+            candidates[num_remained++] = candidates[i];
+        } else {
+            candidates[num_remained] = candidates[i];
+            candidates[num_remained++].stop_node = -1;
+        }
+    }
+    candidates.resize(num_remained);
+
+    // a node loses its outgoings (incomings) only if backward (forward) tips attached to it are removed
+    for (int dir = 0; dir < 2; ++dir) {
+        for (size_t i = 0; i < touched[dir].size(); ++i) {
+            int64_t node_idx = touched[dir][i];
+            if (dbg.IsValidNode(node_idx) && (dir == 0 ? dbg.OutdegreeZero(node_idx) : dbg.IndegreeZero(node_idx))) {
+                candidates.push_back(TipCandidate(node_idx, dir));
+            }
         }
     }
 
     return number_tips;
 }
 
+int64_t Trim(SuccinctDBG &dbg, int len, int min_final_contig_len) {
+    vector<TipCandidate> candidates;
+    CollectTipCandidates(dbg, candidates);
+    return TrimCandidates(dbg, len, min_final_contig_len, candidates);
+}
+
 int64_t RemoveTips(SuccinctDBG &dbg, int max_tip_len, int min_final_contig_len) {
     int64_t number_tips = 0;
     xtimer_t timer;
-    for (int len = 2; len < max_tip_len; len *= 2) {
+    vector<TipCandidate> candidates;
+    CollectTipCandidates(dbg, candidates);
+
+    for (int len = 2; ; len *= 2) {
+        len = std::min(len, max_tip_len);
         printf("Removing tips with length less than %d\n", len);
         timer.reset();
         timer.start();
-        number_tips += Trim(dbg, len, min_final_contig_len);
+        number_tips += TrimCandidates(dbg, len, min_final_contig_len, candidates);
         timer.stop();
         printf("Accumulated tips removed: %lld; time elapsed: %.4f\n", (long long)number_tips, timer.elapsed());
+        if (len == max_tip_len) { break; }
     }
-    printf("Removing tips with length less than %d\n", max_tip_len);
-    timer.reset();
-    timer.start();
-    number_tips += Trim(dbg, max_tip_len, min_final_contig_len);
-    timer.stop();
-    printf("Accumulated tips removed: %lld; time elapsed: %.4f\n", (long long)number_tips, timer.elapsed());
     return number_tips;
 }
 
+// lock the nodes of a bubble and the two nodes adjacent to it, such that bubbles claimed
+// successfully can be removed concurrently without changing the search results of each other
+static bool ClaimBubble(SuccinctDBG &dbg, BranchGroup &bubble, vector<int64_t> &nodes) {
+    nodes.clear();
+    for (unsigned i = 0; i < bubble.num_branches(); ++i) {
+        for (unsigned j = 0; j < bubble.length(); ++j) {
+            nodes.push_back(bubble.node(i, j));
+        }
+    }
+
+    int64_t neighbours[4];
+    if (dbg.Incomings(bubble.begin_node(), neighbours) == 1) {
+        nodes.push_back(neighbours[0]);
+    }
+    if (dbg.Outgoings(bubble.end_node(), neighbours) == 1) {
+        nodes.push_back(neighbours[0]);
+    }
+    std::sort(nodes.begin(), nodes.end());
+    nodes.erase(std::unique(nodes.begin(), nodes.end()), nodes.end());
+
+    for (unsigned i = 0; i < nodes.size(); ++i) {
+        if (!marked.lock(nodes[i])) {
+            for (unsigned j = 0; j < i; ++j) {
+                marked.unset(nodes[j]);
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
 int64_t PopBubbles(SuccinctDBG &dbg, int max_bubble_len, double low_depth_ratio) {
-    omp_lock_t bubble_lock;
-    omp_init_lock(&bubble_lock);
-    const int kMaxBranchesPerGroup = 4;
+    const int kMaxBranchesPerGroup = BranchGroup::kMaxBranchesPerGroup;
     if (max_bubble_len <= 0) { max_bubble_len = dbg.kmer_k * 2 + 2; }
-    vector<std::pair<int, int64_t> > bubble_candidates;
+    int num_threads = omp_get_max_threads();
+    // search results of the candidates are saved compactly, bubble_offsets[t] indexes bubble_candidates[t]
+    vector<vector<int64_t> > bubble_candidates(num_threads);
+    vector<vector<size_t> > bubble_offsets(num_threads);
+    vector<vector<int64_t> > deferred_bubbles(num_threads);
+    vector<vector<int64_t> > claimed_nodes(num_threads);
     int64_t num_bubbles = 0;
 
 #pragma omp parallel for
@@ -168,33 +296,64 @@ int64_t PopBubbles(SuccinctDBG &dbg, int max_bubble_len, double low_depth_ratio)
         if (dbg.IsValidNode(node_idx) && dbg.IsLast(node_idx) && dbg.Outdegree(node_idx) > 1) {
             BranchGroup bubble(&dbg, node_idx, kMaxBranchesPerGroup, max_bubble_len);
             if (bubble.Search()) {
-                omp_set_lock(&bubble_lock);
-                bubble_candidates.push_back(std::make_pair(bubble.length(), node_idx));
-                omp_unset_lock(&bubble_lock);
+                int thread_id = omp_get_thread_num();
+                bubble_offsets[thread_id].push_back(bubble_candidates[thread_id].size());
+                bubble.Save(bubble_candidates[thread_id]);
+            }
+        }
+    }
+
+    // remove bubbles not overlapping with others in parallel, using the search results
+    marked.reset(dbg.size);
+    for (int t = 0; t < num_threads; ++t) {
+        vector<size_t> &offsets = bubble_offsets[t];
+#pragma omp parallel for reduction(+:num_bubbles)
+        for (unsigned i = 0; i < offsets.size(); ++i) {
+            int thread_id = omp_get_thread_num();
+            BranchGroup bubble(&dbg, &bubble_candidates[t][offsets[i]]);
+            if (!ClaimBubble(dbg, bubble, claimed_nodes[thread_id])) {
+                deferred_bubbles[thread_id].push_back(bubble.begin_node());
+            } else if (bubble.RemoveErrorBranches(low_depth_ratio)) {
+                ++num_bubbles;
             }
         }
+        vector<int64_t>().swap(bubble_candidates[t]);
+        vector<size_t>().swap(offsets);
+    }
+
+    // the conflicting ones are searched again as the graph may be changed
+    vector<int64_t> deferred;
+    for (int t = 0; t < num_threads; ++t) {
+        deferred.insert(deferred.end(), deferred_bubbles[t].begin(), deferred_bubbles[t].end());
     }
+    std::sort(deferred.begin(), deferred.end());
 
-    for (unsigned i = 0; i < bubble_candidates.size(); ++i) {
-        BranchGroup bubble(&dbg, bubble_candidates[i].second, kMaxBranchesPerGroup, max_bubble_len);
+    for (unsigned i = 0; i < deferred.size(); ++i) {
+        BranchGroup bubble(&dbg, deferred[i], kMaxBranchesPerGroup, max_bubble_len);
         if (bubble.Search() && bubble.RemoveErrorBranches(low_depth_ratio)) {
             ++num_bubbles;
         }
     }
 
-    omp_destroy_lock(&bubble_lock);
     return num_bubbles;
 }
 
-void AssembleFromUnitigGraph(SuccinctDBG &dbg, FILE *contigs_file, FILE *multi_file, FILE *final_contig_file, int min_final_contig_len) {
+int64_t RemoveTips(UnitigGraph &unitig_graph, int max_tip_len, int min_final_contig_len) {
     xtimer_t timer;
     timer.reset();
     timer.start();
-    UnitigGraph unitig_graph(&dbg);
-    unitig_graph.InitFromSdBG();
+    int64_t number_tips = unitig_graph.RemoveTips(max_tip_len, min_final_contig_len);
     timer.stop();
-    printf("unitig graph size: %u, time for building: %lf\n", unitig_graph.size(), timer.elapsed());
-    
+    printf("Tips removed on unitig graph: %lld; time elapsed: %.4f\n", (long long)number_tips, timer.elapsed());
+    return number_tips;
+}
+
+int64_t PopBubbles(UnitigGraph &unitig_graph, int max_bubble_len, double low_depth_ratio) {
+    return unitig_graph.MergeBubbles(max_bubble_len, low_depth_ratio);
+}
+
+void AssembleFromUnitigGraph(UnitigGraph &unitig_graph, FILE *contigs_file, FILE *multi_file, FILE *final_contig_file, int min_final_contig_len) {
+    xtimer_t timer;
     timer.reset();
     timer.start();
     histogram.clear();
@@ -208,15 +367,8 @@ void AssembleFromUnitigGraph(SuccinctDBG &dbg, FILE *contigs_file, FILE *multi_f
     printf("Time to output: %lf\n", timer.elapsed());
 }
 
-void AssembleFinalFromUnitigGraph(SuccinctDBG &dbg, FILE *final_contig_file, int min_final_contig_len) {
+void AssembleFinalFromUnitigGraph(UnitigGraph &unitig_graph, FILE *final_contig_file, int min_final_contig_len) {
     xtimer_t timer;
-    timer.reset();
-    timer.start();
-    UnitigGraph unitig_graph(&dbg);
-    unitig_graph.InitFromSdBG();
-    timer.stop();
-    printf("unitig graph size: %u, time for building: %lf\n", unitig_graph.size(), timer.elapsed());
-    
     timer.reset();
     timer.start();
     histogram.clear();
@@ -226,17 +378,10 @@ void AssembleFinalFromUnitigGraph(SuccinctDBG &dbg, FILE *final_contig_file, int
     printf("Time to output: %lf\n", timer.elapsed());
 }
 
-void RemoveLowLocalAndOutputChanged(SuccinctDBG &dbg, FILE *contigs_file, FILE *multi_file, FILE *final_contig_file, 
+void RemoveLowLocalAndOutputChanged(UnitigGraph &unitig_graph, FILE *contigs_file, FILE *multi_file, FILE *final_contig_file, 
                                     FILE *addi_contig_file, FILE *addi_multi_file, 
                                     double min_depth, int min_len, double local_ratio, int min_final_contig_len) {
     xtimer_t timer;
-    timer.reset();
-    timer.start();
-    UnitigGraph unitig_graph(&dbg);
-    unitig_graph.InitFromSdBG();
-    timer.stop();
-    printf("Simple path graph size: %u, time for building: %lf\n", unitig_graph.size(), timer.elapsed());
-
     timer.reset();
     timer.start();
     histogram.clear();
@@ -251,22 +396,10 @@ void RemoveLowLocalAndOutputChanged(SuccinctDBG &dbg, FILE *contigs_file, FILE *
 
     const double kMaxDepth = 65535;
     const int kLocalWidth = 1000;
-    int64_t num_removed = 0;
     
     timer.reset();
     timer.start();
-    while (min_depth < kMaxDepth) {
-        // xtimer_t local_timer;
-        // local_timer.reset();
-        // local_timer.start();
-        if (!unitig_graph.RemoveLocalLowDepth(min_depth, min_len, kLocalWidth, local_ratio, num_removed)) {
-            break;
-        }
-
-        min_depth *= 1.1;
-        // local_timer.stop();
-        // printf("depth: %lf, num: %ld, time: %lf\n", min_depth, num_removed, local_timer.elapsed());
-    }
+    int64_t num_removed = unitig_graph.RemoveLocalLowDepth(min_depth, kMaxDepth, min_len, kLocalWidth, local_ratio);
     timer.stop();
     printf("Number of unitigs removed: %lld, time: %lf\n", (long long)num_removed, timer.elapsed());
 
@@ -275,20 +408,11 @@ void RemoveLowLocalAndOutputChanged(SuccinctDBG &dbg, FILE *contigs_file, FILE *
     PrintStat();
 }
 
-void RemoveLowLocalAndOutputFinal(SuccinctDBG &dbg, FILE *final_contig_file, 
+void RemoveLowLocalAndOutputFinal(UnitigGraph &unitig_graph, FILE *final_contig_file, 
                                   double min_depth, int min_len, double local_ratio, int min_final_contig_len) {
-    UnitigGraph unitig_graph(&dbg);
-    unitig_graph.InitFromSdBG();
-    printf("Simple path graph size: %u\n", unitig_graph.size());
-
     const double kMaxDepth = 65535;
     const int kLocalWidth = 1000;
-    int64_t num_removed = 0;
-
-    while (min_depth < kMaxDepth && 
-           unitig_graph.RemoveLocalLowDepth(min_depth, min_len, kLocalWidth, local_ratio, num_removed)) {
-        min_depth *= 1.1;
-    }
+    int64_t num_removed = unitig_graph.RemoveLocalLowDepth(min_depth, kMaxDepth, min_len, kLocalWidth, local_ratio);
     printf("Number of unitigs removed: %lld\n", (long long)num_removed);
 
     histogram.clear();
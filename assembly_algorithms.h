@@ -23,6 +23,8 @@
 #include <string>
 #include "succinct_dbg.h"
 
+class UnitigGraph;
+
 using std::vector;
 using std::string;
 
@@ -35,17 +37,18 @@ int64_t PrevSimplePathNode(SuccinctDBG &dbg, int64_t curr_node); // return -1 if
 // tips removal
 int64_t Trim(SuccinctDBG &dbg, int len, int min_final_contig_len);
 int64_t RemoveTips(SuccinctDBG &dbg, int max_tip_len, int min_final_contig_len);
+int64_t RemoveTips(UnitigGraph &unitig_graph, int max_tip_len, int min_final_contig_len);
 
 // bubble merging
 int64_t PopBubbles(SuccinctDBG &dbg, int max_bubble_len, double low_depth_ratio = 1);
+int64_t PopBubbles(UnitigGraph &unitig_graph, int max_bubble_len, double low_depth_ratio = 1);
 
-// assembly
-
-void AssembleFromUnitigGraph(SuccinctDBG &dbg, FILE *contigs_file, FILE *multi_file, FILE *final_contig_file, int min_final_contig_len);
-void AssembleFinalFromUnitigGraph(SuccinctDBG &dbg, FILE *final_contig_file, int min_final_contig_len);
-void RemoveLowLocalAndOutputChanged(SuccinctDBG &dbg, FILE *contigs_file, FILE *multi_file, FILE *final_contig_file, FILE *addi_contig_file, FILE *addi_multi_file, 
+// assembly, the unitig graph should be built by InitFromSdBG() in advance
+void AssembleFromUnitigGraph(UnitigGraph &unitig_graph, FILE *contigs_file, FILE *multi_file, FILE *final_contig_file, int min_final_contig_len);
+void AssembleFinalFromUnitigGraph(UnitigGraph &unitig_graph, FILE *final_contig_file, int min_final_contig_len);
+void RemoveLowLocalAndOutputChanged(UnitigGraph &unitig_graph, FILE *contigs_file, FILE *multi_file, FILE *final_contig_file, FILE *addi_contig_file, FILE *addi_multi_file, 
                                     double min_depth, int min_len, double local_ratio, int min_final_contig_len);
-void RemoveLowLocalAndOutputFinal(SuccinctDBG &dbg, FILE *final_contig_file, 
+void RemoveLowLocalAndOutputFinal(UnitigGraph &unitig_graph, FILE *final_contig_file, 
                                   double min_depth, int min_len, double local_ratio, int min_final_contig_len);
 
 // print stat
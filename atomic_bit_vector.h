@@ -48,6 +48,7 @@ public:
     }
 
     size_t size() { return size_; }
+    word_t *data() { return data_; }
 
     bool get(size_t i) {
         return bool((data_[i / kBitsPerWord] >> i % kBitsPerWord) & 1);
@@ -17,90 +17,132 @@
  */
 
 #include <assert.h>
+#include <string.h>
 #include "branch_group.h"
 
+BranchGroup::BranchGroup(SuccinctDBG *sdbg, const int64_t *saved):
+    sdbg_(sdbg), begin_node_(saved[0]), end_node_(saved[1]), max_branches_(saved[2]), max_length_(saved[3]),
+    num_branches_(saved[2]), length_(saved[3]), status_(kNotMergedOrCorrected) {
+    saved += 4;
+    for (int i = 0; i < num_branches_; ++i) {
+        multiplicities_[i] = saved[i];
+    }
+    saved += num_branches_;
+    for (int i = 0; i < num_branches_; ++i) {
+        memcpy(branches_[i], saved, sizeof(int64_t) * length_);
+        saved += length_;
+    }
+}
+
+size_t BranchGroup::Save(std::vector<int64_t> &buffer) {
+    size_t old_size = buffer.size();
+    buffer.push_back(begin_node_);
+    buffer.push_back(end_node_);
+    buffer.push_back(num_branches_);
+    buffer.push_back(length_);
+    buffer.insert(buffer.end(), multiplicities_, multiplicities_ + num_branches_);
+    for (int i = 0; i < num_branches_; ++i) {
+        buffer.insert(buffer.end(), branches_[i], branches_[i] + length_);
+    }
+    return buffer.size() - old_size;
+}
+
 bool BranchGroup::Search() {
-    if (sdbg_->Indegree(begin_node_) != 1 || sdbg_->Outdegree(begin_node_) > max_branches_ || sdbg_->Outdegree(begin_node_) <= 1) {
+    if (sdbg_->Indegree(begin_node_) != 1) {
         return false;
     }
 
-    branches_.push_back(BranchRecord(1, begin_node_));
-    multiplicities_.push_back(0);
+    num_branches_ = 1;
+    length_ = 1;
+    branches_[0][0] = begin_node_;
+    multiplicities_[0] = 0;
 
+    // outgoings of the last nodes of the current branches, shared by branches ending at the same node
+    int64_t outgoings[kMaxBranchesPerGroup][4];
+    int edge_countings[kMaxBranchesPerGroup][4];
+    int out_degrees[kMaxBranchesPerGroup];
     bool converged = false;
 
     for (int j = 1; j < max_length_; ++j) {
-        int num_branches = branches_.size();
+        int num_branches = num_branches_;
         for (int i = 0; i < num_branches; ++i) {
-            int64_t current = branches_[i].back();
-            int64_t outgoings[4];
-            int edge_countings[4];
-            int out_degree = sdbg_->Outgoings(current, outgoings, edge_countings);
-
-            for (int x = 0; x < out_degree; ++x) {
-                assert(sdbg_->IsLast(outgoings[x]));
+            int64_t current = branches_[i][j - 1];
+            int shared = 0;
+            while (shared < i && branches_[shared][j - 1] != current) {
+                ++shared;
             }
-
-            if (out_degree >= 1) {
-                // append this node the last of current branch
-                branches_[i].push_back(outgoings[0]);
-                multiplicities_[i] += edge_countings[0];
-
-                if ((int)branches_.size() + out_degree - 1 > max_branches_) {
-                    // too many branches
-                    return false;
-                } else {
-                    BranchRecord curr_branch = branches_[i];
-                    int curr_branch_multiplicity = multiplicities_[i] - edge_countings[0];
-                    for (int x = 1; x < out_degree; ++x) {
-                        curr_branch.pop_back();
-                        curr_branch.push_back(outgoings[x]);
-                        branches_.push_back(curr_branch);
-                        multiplicities_.push_back(curr_branch_multiplicity + edge_countings[x]);
-                    }
+            if (shared == i) {
+                out_degrees[i] = sdbg_->Outgoings(current, outgoings[i], edge_countings[i]);
+                for (int x = 0; x < out_degrees[i]; ++x) {
+                    assert(sdbg_->IsLast(outgoings[i][x]));
                 }
             }
-        }
 
-        // check whether all branches's last nodes are coming from this branch group
-        for (unsigned i = 0; i < branches_.size(); ++i) {
-            int64_t last_node = branches_[i].back();
-            int64_t incomings[4];
-            int in_degree = sdbg_->Incomings(last_node, incomings);
-            for (int x = 0; x < in_degree; ++x) {
-                assert(sdbg_->IsLast(incomings[x]));
+            int out_degree = out_degrees[shared];
+            int64_t *out_nodes = outgoings[shared];
+            int *out_countings = edge_countings[shared];
+            out_degrees[i] = out_degree;
+
+            if (out_degree == 0 || (j == 1 && out_degree == 1)) {
+                // a dead end never converges; the begin node must be a fork
+                return false;
+            }
+            if (num_branches_ + out_degree - 1 > max_branches_) {
+                // too many branches
+                return false;
             }
 
-            if (in_degree == 1) {
-                continue;
-            } else {
-                for (int x = 0; x < in_degree; ++x) {
-                    bool exist_in_group = false;
-                    for (auto it = branches_.begin(); it != branches_.end(); ++it) {
-                        if ((*it)[j - 1] == incomings[x]) {
-                            exist_in_group = true;
-                            break;
-                        }
-                    }
-                    if (!exist_in_group) {
-                        return false;
-                    }
+            // append the first outgoing to the current branch, fork the others
+            int curr_branch_multiplicity = multiplicities_[i];
+            branches_[i][j] = out_nodes[0];
+            multiplicities_[i] += out_countings[0];
+            for (int x = 1; x < out_degree; ++x) {
+                memcpy(branches_[num_branches_], branches_[i], sizeof(int64_t) * j);
+                branches_[num_branches_][j] = out_nodes[x];
+                multiplicities_[num_branches_] = curr_branch_multiplicity + out_countings[x];
+                ++num_branches_;
+            }
+        }
+        length_ = j + 1;
+
+        // check whether all branches's last nodes are coming from this branch group, i.e. the indegree 
+        // of each last node equals to the number of distinct nodes in the group preceding it
+        for (int i = 0; i < num_branches_; ++i) {
+            int64_t last_node = branches_[i][j];
+            bool visited = false;
+            for (int x = 0; x < i && !visited; ++x) {
+                visited = branches_[x][j] == last_node;
+            }
+            if (visited) { continue; }
+
+            int num_preceding = 0;
+            for (int x = i; x < num_branches_; ++x) {
+                if (branches_[x][j] != last_node) { continue; }
+                bool counted = false;
+                for (int y = i; y < x && !counted; ++y) {
+                    counted = branches_[y][j] == last_node && branches_[y][j - 1] == branches_[x][j - 1];
                 }
+                num_preceding += !counted;
+            }
+
+            if (sdbg_->Indegree(last_node) != num_preceding) {
+                return false;
             }
         }
 
         // check converge
-        end_node_ = branches_[0].back();
-        if (sdbg_->Outdegree(end_node_) == 1) {
-            converged = true;
-            for (unsigned i = 1; i < branches_.size(); ++i) {
-                if (branches_[i].back() != end_node_) {
-                    converged = false;
-                    break;
-                }
+        end_node_ = branches_[0][j];
+        converged = true;
+        for (int i = 1; i < num_branches_; ++i) {
+            if (branches_[i][j] != end_node_) {
+                converged = false;
+                break;
             }
-            if (converged) { break; }
         }
+        if (converged && sdbg_->Outdegree(end_node_) == 1) {
+            break;
+        }
+        converged = false;
     }
     return converged && begin_node_ != end_node_;
 }
@@ -108,36 +150,37 @@ bool BranchGroup::Search() {
 bool BranchGroup::RemoveErrorBranches(double cutoff_ratio) {
     int best_multiplicity = multiplicities_[0];
 
-    for (unsigned i = 1; i < branches_.size(); ++i) {
+    for (int i = 1; i < num_branches_; ++i) {
         int curr_multiplicity = multiplicities_[i];
         if (curr_multiplicity >= best_multiplicity) {
             best_multiplicity = curr_multiplicity;
         }
     }
 
-    vector<unsigned> not_removed;
-    not_removed.reserve(branches_.size());
-    for (unsigned i = 0; i < branches_.size(); ++i) {
+    int not_removed[kMaxBranchesPerGroup];
+    int num_not_removed = 0;
+    for (int i = 0; i < num_branches_; ++i) {
         if (multiplicities_[i] == best_multiplicity || multiplicities_[i] > cutoff_ratio * best_multiplicity) {
-            not_removed.push_back(i);
+            not_removed[num_not_removed++] = i;
             continue;
         }
-        for (unsigned j = 1; j + 1 < branches_[i].size(); ++j) {
+        for (int j = 1; j + 1 < length_; ++j) {
             sdbg_->SetInvalid(branches_[i][j]);
         }
     }
 
-    unsigned num_remained = 0;
-    for (unsigned i = 0; i < not_removed.size(); ++i) {
+    int num_remained = 0;
+    for (int i = 0; i < num_not_removed; ++i) {
         if (num_remained != not_removed[i]) {
-            branches_[num_remained] = branches_[not_removed[i]];
+            memcpy(branches_[num_remained], branches_[not_removed[i]], sizeof(int64_t) * length_);
+            multiplicities_[num_remained] = multiplicities_[not_removed[i]];
         }
-        for (unsigned j = 1; j + 1 < branches_[num_remained].size(); ++j) {
+        for (int j = 1; j + 1 < length_; ++j) {
             sdbg_->SetValid(branches_[num_remained][j]);
         }
         ++num_remained;
     }
-    branches_.resize(num_remained);
+    num_branches_ = num_remained;
 
     if (num_remained == 1) {
         status_ = kErrorRemoved;
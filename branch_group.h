@@ -21,57 +21,51 @@
 
 #include <stdint.h>
 #include <vector>
+#include <algorithm>
 #include "succinct_dbg.h"
 
 class BranchGroup
 {
 public:
-    typedef std::vector<int64_t> BranchRecord;
+    static const int kMaxBranchesPerGroup = 4;
+    static const int kMaxBranchLength = SuccinctDBG::kMaxKmerK * 2 + 2;
 
     BranchGroup(SuccinctDBG *sdbg, int64_t begin_node, int max_branches = 2, int max_length = 0):
-        sdbg_(sdbg), begin_node_(begin_node), max_branches_(max_branches), max_length_(max_length), status_(kNotMergedOrCorrected) {
-        branches_.reserve(max_branches_);
-        multiplicities_.reserve(max_branches_);
+        sdbg_(sdbg), begin_node_(begin_node), end_node_(-1), max_branches_(max_branches), max_length_(max_length), 
+        num_branches_(0), length_(0), status_(kNotMergedOrCorrected) {
         if (max_length <= 0) {
             max_length_ = sdbg->kmer_k * 2 + 2;
         }
+        max_branches_ = std::min(max_branches_, kMaxBranchesPerGroup);
+        max_length_ = std::min(max_length_, kMaxBranchLength);
     }
 
-    BranchGroup(const BranchGroup &rhs):
-        sdbg_(rhs.sdbg_), begin_node_(rhs.begin_node_), end_node_(rhs.end_node_), 
-        max_branches_(rhs.max_branches_), max_length_(rhs.max_length_), branches_(rhs.branches_),
-        multiplicities_(rhs.multiplicities_), status_(kNotMergedOrCorrected) { }
-
-    BranchGroup& operator= (const BranchGroup &rhs) {
-        sdbg_ = rhs.sdbg_;
-        begin_node_ = rhs.begin_node_;
-        end_node_ = rhs.end_node_;
-        max_branches_ = rhs.max_branches_;
-        max_length_ = rhs.max_length_;
-        branches_ = rhs.branches_;
-        multiplicities_ = rhs.multiplicities_;
-        status_ = rhs.status_;
-
-        return *this;
-    }
+    // restore a group saved by Save(), without searching the graph again
+    BranchGroup(SuccinctDBG *sdbg, const int64_t *saved);
 
     bool Search();
     bool RevSearch();
     bool RemoveErrorBranches(double cutoff_ratio = 0.5);
     bool Merge();
-    size_t length() {
-        if (branches_.size() == 0) { return 0; }
-        return branches_[0].size();
-    }
+    // append the search result to buffer, return the number of words appended
+    size_t Save(std::vector<int64_t> &buffer);
+
+    size_t length() { return length_; }
+    int64_t begin_node() { return begin_node_; }
+    int64_t end_node() { return end_node_; }
+    size_t num_branches() { return num_branches_; }
+    int64_t node(int branch, int pos) { return branches_[branch][pos]; }
 
 private:
     SuccinctDBG *sdbg_;
     int64_t begin_node_;
     int64_t end_node_;
-    int64_t max_branches_;
-    int64_t max_length_;
-    vector<BranchRecord> branches_;
-    vector<int> multiplicities_;
+    int max_branches_;
+    int max_length_;
+    int num_branches_;
+    int length_;
+    int64_t branches_[kMaxBranchesPerGroup][kMaxBranchLength];
+    int multiplicities_[kMaxBranchesPerGroup];
     enum BranchGroupStatus {
         kNotMergedOrCorrected,
         kErrorRemoved,
@@ -19,19 +19,89 @@
 
 using namespace std;
 
-const CompactSequence &CompactSequence::Append(const CompactSequence &compact_seq, int offset, size_t length)
+// the n (1 <= n <= 32) bases from pos, in the lowest bits
+static inline uint64_t ExtractBases(const uint64_t *words, int64_t pos, int n)
 {
-    if (length == std::string::npos || length > compact_seq.size() - offset)
-        length = compact_seq.size() - offset;
+    int64_t w = pos / CompactSequence::kBasesPerWord;
+    int shift = pos % CompactSequence::kBasesPerWord * 2;
+    uint64_t bases = words[w] >> shift;
+    if (shift != 0 && shift + n * 2 > 64)
+        bases |= words[w + 1] << (64 - shift);
+    return n == CompactSequence::kBasesPerWord ? bases : bases & ((uint64_t(1) << (n * 2)) - 1);
+}
+
+static inline void DepositBases(uint64_t *words, int64_t pos, int n, uint64_t bases)
+{
+    int64_t w = pos / CompactSequence::kBasesPerWord;
+    int shift = pos % CompactSequence::kBasesPerWord * 2;
+    words[w] |= bases << shift;
+    if (shift != 0 && shift + n * 2 > 64)
+        words[w + 1] |= bases >> (64 - shift);
+}
+
+void CompactSequence::CopyBases(const uint64_t *src, int64_t src_pos, int64_t length, uint64_t *dst, int64_t dst_pos)
+{
+    for (int64_t i = 0; i < length; i += kBasesPerWord) {
+        int n = std::min(length - i, (int64_t)kBasesPerWord);
+        DepositBases(dst, dst_pos + i, n, ExtractBases(src, src_pos + i, n));
+    }
+}
+
+void CompactSequence::CopyReverseComplement(const uint64_t *src, int64_t src_pos, int64_t length, uint64_t *dst, int64_t dst_pos)
+{
+    for (int64_t i = 0; i < length; i += kBasesPerWord) {
+        int n = std::min(length - i, (int64_t)kBasesPerWord);
+        uint64_t bases = ExtractBases(src, src_pos + length - i - n, n);
+        bit_operation::ReverseComplement(bases);
+        if (n != kBasesPerWord)
+            bases >>= (kBasesPerWord - n) * 2;
+        DepositBases(dst, dst_pos + i, n, bases);
+    }
+}
+
+void CompactSequence::DecodeBases(const uint64_t *words, int64_t pos, int64_t length, char *dna)
+{
+    // the 4 characters of each byte
+    static struct DecodeTable {
+        char chars[256][4];
+        DecodeTable() {
+            for (int b = 0; b < 256; ++b)
+                for (int j = 0; j < 4; ++j)
+                    chars[b][j] = "ACGT"[(b >> (j * 2)) & 3];
+        }
+    } table;
 
+    int64_t i = 0;
+    for (; i < length && (pos + i) % 4 != 0; ++i)
+        dna[i] = "ACGT"[(words[(pos + i) / kBasesPerWord] >> ((pos + i) % kBasesPerWord * 2)) & 3];
+    for (; i + 4 <= length; i += 4) {
+        uint8_t byte = words[(pos + i) / kBasesPerWord] >> ((pos + i) % kBasesPerWord * 2);
+        memcpy(dna + i, table.chars[byte], 4);
+    }
+    for (; i < length; ++i)
+        dna[i] = "ACGT"[(words[(pos + i) / kBasesPerWord] >> ((pos + i) % kBasesPerWord * 2)) & 3];
+}
+
+const CompactSequence &CompactSequence::Append(const uint64_t *words, int64_t pos, uint32_t length)
+{
     uint32_t old_size = size();
     resize(old_size + length);
-
-    for (unsigned i = 0; i < length; ++i)
-        set_base(i + old_size, compact_seq[i + offset]);
+    CopyBases(words, pos, length, data_.data(), old_size);
     return *this;
 }
 
+const CompactSequence &CompactSequence::Append(const CompactSequence &compact_seq, int offset, size_t length)
+{
+    if (length == std::string::npos || length > compact_seq.size() - offset)
+        length = compact_seq.size() - offset;
+
+    if (&compact_seq == this) {
+        CompactSequence copy(compact_seq);
+        return Append(copy.data(), offset, length);
+    }
+    return Append(compact_seq.data(), offset, length);
+}
+
 const CompactSequence &CompactSequence::Append(const std::string &seq, int offset, size_t length)
 {
     if (length == std::string::npos || length > seq.size() - offset)
@@ -40,55 +110,52 @@ const CompactSequence &CompactSequence::Append(const std::string &seq, int offse
     uint32_t old_size = size();
     resize(old_size + length);
 
-    for (unsigned i = 0; i < length; ++i)
-        set_base(i + old_size, seq[i + offset]);
+    for (unsigned i = 0; i < length; i += kBasesPerWord) {
+        int n = std::min(length - i, (size_t)kBasesPerWord);
+        uint64_t bases = 0;
+        for (int j = n - 1; j >= 0; --j)
+            bases = (bases << 2) | (seq[offset + i + j] & 3);
+        DepositBases(data_.data(), old_size + i, n, bases);
+    }
     return *this;
 }
 
 const CompactSequence &CompactSequence::Append(uint8_t ch)
 {
-    if (data_[data_.size()-1] > 0) {
-        data_[data_.size()-2] &= (1 << ((4 - data_[data_.size()-1]) << 1)) - 1;
-        data_[data_.size()-2] |= (ch&3) << ((4 - data_[data_.size()-1]) << 1);
-        --data_[data_.size()-1];
-    } else {
-        data_[data_.size()-1] = ch & 3;
-        data_.push_back(3);
-    }
+    if (size_ % kBasesPerWord == 0)
+        data_.push_back(0);
+    data_.back() |= uint64_t(ch & 3) << (size_ % kBasesPerWord * 2);
+    ++size_;
     return *this;
 }
 
 const CompactSequence &CompactSequence::ReverseComplement()
 {
-    uint8_t remain_bases = data_[data_.size()-1];
-    reverse(data_.begin(), data_.begin() + data_.size() - 1);
-    for (unsigned i = 0; i+1 < data_.size(); ++i)
-        data_[i] = bit_operation::ReverseComplement(data_[i]);
-    for (unsigned i = 0; i+2 < data_.size(); ++i)
-        data_[i] = (uint8_t(data_[i]) >> (remain_bases<<1)) | (uint8_t(data_[i+1]) << ((4-remain_bases)<<1));
-    data_[data_.size()-2] >>= (remain_bases << 1);
+    // reverse the words and the bases in them, then shift the bases down to the beginning
+    int pad = (data_.size() * kBasesPerWord - size_) * 2;
+    reverse(data_.begin(), data_.end());
+    for (unsigned i = 0; i < data_.size(); ++i)
+        bit_operation::ReverseComplement(data_[i]);
+    if (pad != 0) {
+        for (unsigned i = 0; i + 1 < data_.size(); ++i)
+            data_[i] = (data_[i] >> pad) | (data_[i + 1] << (64 - pad));
+        data_.back() >>= pad;
+    }
     return *this;
 }
 
 const CompactSequence &CompactSequence::Reverse()
 {
-    uint8_t remain_bases = data_[data_.size()-1];
-    reverse(data_.begin(), data_.begin() + data_.size() - 1);
-    for (unsigned i = 0; i+1 < data_.size(); ++i)
-        data_[i] = bit_operation::Reverse(data_[i]);
-    for (unsigned i = 0; i+2 < data_.size(); ++i)
-        data_[i] = (uint8_t(data_[i]) >> (remain_bases<<1)) | (uint8_t(data_[i+1]) << ((4-remain_bases)<<1));
-    data_[data_.size()-2] >>= (remain_bases << 1);
+    for (unsigned i = 0; i < data_.size(); ++i)
+        data_[i] = ~data_[i];
+    ReverseComplement();
     return *this;
 }
 
-std::string CompactSequence::ToDNAString()
+std::string CompactSequence::ToDNAString() const
 {
-    static char acgt[] = "ACGT";
-    std::string dna;
-    dna.resize(this->size());
-    for (unsigned i = 0; i < this->size(); ++i) {
-        dna[i] = acgt[this->get_base(i)];
-    }
+    std::string dna(size(), 0);
+    if (!dna.empty())
+        DecodeBases(data_.data(), 0, size(), &dna[0]);
     return dna;
 }
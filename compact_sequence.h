@@ -16,6 +16,8 @@
 #include <assert.h>
 #include <cstring>
 #include <string>
+#include <vector>
+#include <algorithm>
 
 
 class Sequence;
@@ -25,18 +27,22 @@ class ShortSequence;
  * @brief It is a compact format of DNA sequence. It has the same 
  * functionalities as Sequence Class but uses less memory and more 
  * computational cost.
+ * The bases are packed 32 per 64-bit word, the i-th base in bits 2*(i%32) of
+ * word i/32 (the layout of the label arena of UnitigGraph); bits beyond size()
+ * are always zero. The static helpers work on any array of such words.
  */
 class CompactSequence
 {
 public:
+    static const int kBasesPerWord = 32;
 
     CompactSequence() { clear(); }
     CompactSequence(const CompactSequence &compact_seq)
-    { data_ = compact_seq.data_; }
+    { data_ = compact_seq.data_; size_ = compact_seq.size_; }
     CompactSequence(const CompactSequence &compact_seq, int offset, size_t length)
-    { Assign(compact_seq, offset, length); }
+    { clear(); Assign(compact_seq, offset, length); }
     explicit CompactSequence(const std::string &seq, int offset = 0, size_t length = std::string::npos)
-    { Assign(seq, offset, length); }
+    { clear(); Assign(seq, offset, length); }
 
     const CompactSequence &operator =(const CompactSequence &compact_seq) { Assign(compact_seq); return *this; }
     const CompactSequence &operator =(const std::string &seq) { Assign(seq); return *this; }
@@ -45,10 +51,10 @@ public:
     const CompactSequence &operator +=(const std::string &seq) { Append(seq); return *this; }
     const CompactSequence &operator +=(uint8_t ch) { Append(ch); return *this; }
 
-    bool operator ==(const CompactSequence &seq) const { return data_ == seq.data_; }
-    bool operator !=(const CompactSequence &seq) const { return data_ != seq.data_; }
-    bool operator <(const CompactSequence &seq) const { return data_ < seq.data_; }
-    bool operator >(const CompactSequence &seq) const { return data_ > seq.data_; }
+    bool operator ==(const CompactSequence &seq) const { return size_ == seq.size_ && data_ == seq.data_; }
+    bool operator !=(const CompactSequence &seq) const { return !(*this == seq); }
+    bool operator <(const CompactSequence &seq) const { return size_ != seq.size_ ? size_ < seq.size_ : data_ < seq.data_; }
+    bool operator >(const CompactSequence &seq) const { return seq < *this; }
 
     const CompactSequence &Assign(const CompactSequence &compact_seq, int offset = 0, size_t length = std::string::npos)
     { if (&compact_seq != this) { resize(0); Append(compact_seq, offset, length); } return *this; }
@@ -58,34 +64,51 @@ public:
     const CompactSequence &Append(const CompactSequence &compact_seq, int offset = 0, size_t length = std::string::npos);
     const CompactSequence &Append(const std::string &seq, int offset = 0, size_t length = std::string::npos);
     const CompactSequence &Append(uint8_t ch);
+    // append length bases of a packed array, starting from base pos
+    const CompactSequence &Append(const uint64_t *words, int64_t pos, uint32_t length);
 
     const CompactSequence &ReverseComplement();
     const CompactSequence &Reverse();
 
-    std::string ToDNAString();
+    std::string ToDNAString() const;
 
     uint8_t operator [](uint32_t index) const 
-    { return (data_[index>>2] >> ((index&3) << 1)) & 3; }
+    { return (data_[index>>5] >> ((index&31) << 1)) & 3; }
     uint8_t get_base(uint32_t index) const 
-    { return (data_[index>>2] >> ((index&3) << 1)) & 3; }
+    { return (data_[index>>5] >> ((index&31) << 1)) & 3; }
     void set_base(uint32_t index, uint8_t ch)
-    { data_[index>>2] = (data_[index>>2] & ~(3U << ((index&3) << 1))) | (ch&3) << ((index&3) << 1); }
+    { data_[index>>5] = (data_[index>>5] & ~(uint64_t(3) << ((index&31) << 1))) | uint64_t(ch&3) << ((index&31) << 1); }
+
+    const uint64_t *data() const { return data_.data(); }
 
     void swap(CompactSequence &compact_seq) 
-    { if (this != &compact_seq) data_.swap(compact_seq.data_); }
+    { if (this != &compact_seq) { data_.swap(compact_seq.data_); std::swap(size_, compact_seq.size_); } }
 
     uint32_t size() const 
-    { return ((data_.size()-1) << 2) - data_[data_.size()-1]; }
+    { return size_; }
     uint32_t length() const
     { return size(); }
     void resize(int new_size) 
-    { data_.resize((new_size + 7) >> 2); data_[data_.size()-1] = ((data_.size() - 1) << 2) - new_size; }
+    {
+        data_.resize((new_size + kBasesPerWord - 1) / kBasesPerWord, 0);
+        if (new_size < (int)size_ && new_size % kBasesPerWord != 0)
+            data_.back() &= (uint64_t(1) << (new_size % kBasesPerWord * 2)) - 1;
+        size_ = new_size;
+    }
     bool empty() const { return size() == 0; }
 
-    void clear() { resize(0); }
+    void clear() { data_.clear(); size_ = 0; }
+
+    // copy length bases of src from src_pos to dst from dst_pos; the bits to be written in dst must be zero
+    static void CopyBases(const uint64_t *src, int64_t src_pos, int64_t length, uint64_t *dst, int64_t dst_pos);
+    // the same as CopyBases, but the bases are reverse complemented
+    static void CopyReverseComplement(const uint64_t *src, int64_t src_pos, int64_t length, uint64_t *dst, int64_t dst_pos);
+    // write length bases from pos as "ACGT" characters, without a terminating '\0'
+    static void DecodeBases(const uint64_t *words, int64_t pos, int64_t length, char *dna);
 
 private:
-    std::basic_string<uint8_t> data_;
+    std::vector<uint64_t> data_;
+    uint32_t size_;
 };
 
 namespace std
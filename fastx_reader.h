@@ -66,6 +66,15 @@ public:
         return *(p_++);
     }
 
+    // read the rest of the line, without the '\n'
+    void ReadLine(std::string &line) {
+        line.clear();
+        char c;
+        while (!eof() && (c = NextChar()) != '\n') {
+            line.push_back(c);
+        }
+    }
+
 private:
     // Refill buffer
     void Refill() {
@@ -135,13 +144,18 @@ public:
         return buffer_reader_.eof();
     }
 
-    size_t NextSeq(std::string &seq) {
+    // the header line (without '>' or '@') is stored if header is not NULL
+    size_t NextSeq(std::string &seq, std::string *header = NULL) {
         if (eof()) {
             seq.clear();
             return 0;
         }
         
-        buffer_reader_.SkipLine();
+        if (header != NULL) {
+            buffer_reader_.ReadLine(*header);
+        } else {
+            buffer_reader_.SkipLine();
+        }
         seq.clear();
 
         char c;
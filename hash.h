@@ -32,6 +32,28 @@
 
 #include <functional>
 
+// the finalizer of MurmurHash3, a multiply-xorshift mix in which every input bit affects every
+// output bit; the low bits can be used directly as a power-of-2 table index
+inline uint64_t HashMix(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+// each word is folded into the state by an odd multiplication, which keeps the order of the words
+// significant; a single HashMix at the end spreads the result over all bits
+inline uint64_t HashWords(const uint64_t *words, unsigned num_words)
+{
+    uint64_t h = 0;
+    for (unsigned i = 0; i < num_words; ++i)
+        h = (h ^ words[i]) * 0x9e3779b97f4a7c15ULL;
+    return HashMix(h);
+}
+
 template <typename T>
 struct Hash: public std::unary_function<T, uint64_t>
 {
@@ -43,56 +65,56 @@ template <>
 struct Hash<int8_t>: public std::unary_function<int8_t, uint64_t>
 {
     uint64_t operator ()(int8_t value) const
-    { return (uint64_t(value)* 1299709 + 104729) % 323780508946331ULL; }
+    { return HashMix(uint64_t(value)); }
 };
 
 template <>
 struct Hash<uint8_t>: public std::unary_function<uint8_t, uint64_t>
 {
     uint64_t operator ()(uint8_t value) const
-    { return (uint64_t(value)* 1299709 + 104729) % 323780508946331ULL; }
+    { return HashMix(uint64_t(value)); }
 };
 
 template <>
 struct Hash<int16_t>: public std::unary_function<int16_t, uint64_t>
 {
     uint64_t operator ()(int16_t value) const
-    { return (uint64_t(value)* 1299709 + 104729) % 323780508946331ULL; }
+    { return HashMix(uint64_t(value)); }
 };
 
 template <>
 struct Hash<uint16_t>: public std::unary_function<uint16_t, uint64_t>
 {
     uint64_t operator ()(uint16_t value) const
-    { return (uint64_t(value)* 1299709 + 104729) % 323780508946331ULL; }
+    { return HashMix(uint64_t(value)); }
 };
 
 template <>
 struct Hash<int32_t>: public std::unary_function<int32_t, uint64_t>
 {
     uint64_t operator ()(int32_t value) const
-    { return (uint64_t(value)* 1299709 + 104729) % 323780508946331ULL; }
+    { return HashMix(uint64_t(value)); }
 };
 
 template <>
 struct Hash<uint32_t>: public std::unary_function<uint32_t, uint64_t>
 {
     uint64_t operator ()(uint32_t value) const
-    { return (uint64_t(value)* 1299709 + 104729) % 323780508946331ULL; }
+    { return HashMix(uint64_t(value)); }
 };
 
 template <>
 struct Hash<int64_t>: public std::unary_function<int64_t, uint64_t>
 {
     uint64_t operator ()(int64_t value) const
-    { return (uint64_t(value)* 1299709 + 104729) % 323780508946331ULL; }
+    { return HashMix(uint64_t(value)); }
 };
 
 template <>
 struct Hash<uint64_t>: public std::unary_function<uint64_t, uint64_t>
 {
     uint64_t operator ()(uint64_t value) const
-    { return (uint64_t(value)* 1299709 + 104729) % 323780508946331ULL; }
+    { return HashMix(uint64_t(value)); }
 };
 
 #endif
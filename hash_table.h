@@ -31,14 +31,17 @@
 #define __CONTAINER_HASH_TABLE_H_
 
 #include <omp.h>
+#include <sched.h>
 #include <stdint.h>
 
+#include <algorithm>
 #include <cstddef>
 #include <functional>
 #include <istream>
 #include <ostream>
 #include <stdexcept>
 #include <iostream>
+#include <vector>
 
 #include "pool.h"
 #include "hash.h"
@@ -184,7 +187,9 @@ private:
 /**
  * @brief It is parallel hash table. All insertion/delection operations can be
  * done in parallel. The table size grows automatically, if the number elements
- * exceed the twice of the number of buckets. 
+ * exceed the twice of the number of buckets. The growth is cooperative: the
+ * inserting threads that come in during a resize relink chunks of the old
+ * buckets instead of waiting for it.
  *
  * @tparam Value
  * @tparam Key
@@ -237,7 +242,9 @@ public:
         : hash_(hash), get_key_(get_key), key_equal_(key_equal)
     { 
         size_ = 0;
-        omp_init_lock(&rehash_lock_);
+        resizing_ = 0;
+        migrating_ = 0;
+        num_helpers_ = 0;
         bucket_locks_.resize(kNumBucketLocks);
         for (uint64_t i = 0; i < bucket_locks_.size(); ++i)
             omp_init_lock(&bucket_locks_[i]);
@@ -250,7 +257,9 @@ public:
         key_equal_(hash_table.key_equal_)
     {
         size_ = 0;
-        omp_init_lock(&rehash_lock_);
+        resizing_ = 0;
+        migrating_ = 0;
+        num_helpers_ = 0;
         bucket_locks_.resize(kNumBucketLocks);
         for (uint64_t i = 0; i < bucket_locks_.size(); ++i)
             omp_init_lock(&bucket_locks_[i]);
@@ -263,7 +272,6 @@ public:
         clear();
         for (uint64_t i = 0; i < bucket_locks_.size(); ++i)
             omp_destroy_lock(&bucket_locks_[i]);
-        omp_destroy_lock(&rehash_lock_);
     }
 
     const hash_table_type &operator =(const hash_table_type &hash_table)
@@ -613,19 +621,65 @@ private:
     void unlock_bucket(uint64_t hash_value)
     { omp_unset_lock(&bucket_locks_[hash_value & (kNumBucketLocks-1)]); }
 
+    // the thread that starts a resize does it; the others that come in help it and retry
     void rehash_if_needed(size_type capacity)
     {
-        if (capacity > buckets_.size() * 2)
+        while (resizing_ || capacity > buckets_.size() * 2)
         {
-            omp_set_lock(&rehash_lock_);
-            if (capacity > buckets_.size() * 2) 
+            if (!__sync_bool_compare_and_swap(&resizing_, 0, 1))
+            {
+                help_rehash();
+                continue;
+            }
+
+            if (capacity > buckets_.size() * 2)
             {
                 size_type new_num_buckets = buckets_.size();
                 while (capacity > new_num_buckets * 2)
                     new_num_buckets *= 2;
                 rehash(new_num_buckets);
             }
-            omp_unset_lock(&rehash_lock_);
+            __sync_synchronize();
+            resizing_ = 0;
+        }
+    }
+
+    void help_rehash()
+    {
+        while (resizing_)
+        {
+            if (migrating_)
+            {
+                __sync_fetch_and_add(&num_helpers_, 1);
+                if (migrating_)
+                    migrate_chunks();
+                __sync_fetch_and_sub(&num_helpers_, 1);
+            }
+            sched_yield();
+        }
+    }
+
+    // the nodes of an old bucket only move to the new buckets with the same low bits,
+    // so the chunks are relinked independently
+    void migrate_chunks()
+    {
+        int64_t chunk_id;
+        while ((chunk_id = __sync_fetch_and_add(&migrate_next_, 1)) < num_chunks_)
+        {
+            int64_t end = std::min((int64_t)old_buckets_.size(), (chunk_id + 1) * kBucketsPerChunk);
+            for (int64_t i = chunk_id * kBucketsPerChunk; i < end; ++i)
+            {
+                node_type *node = old_buckets_[i];
+                while (node)
+                {
+                    node_type *next = node->next;
+                    uint64_t index = hash(node->value) & (new_buckets_.size() - 1);
+                    node->next = new_buckets_[index];
+                    new_buckets_[index] = node;
+                    node = next;
+                }
+            }
+            __sync_fetch_and_add(&migrate_done_, 1);
         }
     }
 
@@ -640,27 +694,39 @@ private:
         for (uint64_t i = 0; i < bucket_locks_.size(); ++i)
             omp_set_lock(&bucket_locks_[i]);
 
-        std::vector<node_type *> old_buckets(new_num_buckets, NULL);
-        old_buckets.swap(buckets_);
-
-        if (new_num_buckets > old_buckets.size())
+        if (buckets_.empty())
         {
-#pragma omp parallel for
-            for (int64_t i = 0; i < (int64_t)old_buckets.size(); ++i)
-            {
-                node_type *node = old_buckets[i];
-                while (node)
-                {
-                    node_type *next = node->next;
-                    uint64_t index = bucket_index_value(node->value);
-                    node->next = buckets_[index];
-                    buckets_[index] = node;
-                    node = next;
-                }
-            }
+            // a new table, nothing to move
+            buckets_.assign(new_num_buckets, NULL);
+        }
+        else if (new_num_buckets > buckets_.size())
+        {
+            old_buckets_.swap(buckets_);
+            new_buckets_.assign(new_num_buckets, NULL);
+            num_chunks_ = (old_buckets_.size() + kBucketsPerChunk - 1) / kBucketsPerChunk;
+            migrate_next_ = 0;
+            migrate_done_ = 0;
+            __sync_synchronize();
+            migrating_ = 1;
+
+#pragma omp parallel
+            migrate_chunks();
+            while (migrate_done_ < num_chunks_)
+                sched_yield();
+
+            migrating_ = 0;
+            __sync_synchronize();
+            while (num_helpers_ > 0)
+                sched_yield();
+            buckets_.swap(new_buckets_);
+            std::vector<node_type *>().swap(new_buckets_);
+            std::vector<node_type *>().swap(old_buckets_);
         }
         else
         {
+            std::vector<node_type *> old_buckets(new_num_buckets, NULL);
+            old_buckets.swap(buckets_);
+
 //#pragma omp parallel for
             for (int64_t i = 0; i < (int64_t)old_buckets.size(); ++i)
             {
@@ -690,8 +756,18 @@ private:
     Pool<node_type> pool_;
     std::vector<node_type *> buckets_;
     std::vector<omp_lock_t> bucket_locks_;
-    omp_lock_t rehash_lock_;
     uint64_t size_;
+
+    // for resizing
+    static const int64_t kBucketsPerChunk = (1 << 14);
+    volatile int resizing_;
+    volatile int migrating_;
+    volatile int64_t num_helpers_;
+    volatile int64_t migrate_next_;
+    volatile int64_t migrate_done_;
+    int64_t num_chunks_;
+    std::vector<node_type *> old_buckets_;
+    std::vector<node_type *> new_buckets_;
 };
 
 template <typename Value, typename Key, typename HashFunc,
@@ -30,31 +30,51 @@
 #include "mem_file_checker-inl.h"
 
 struct ContigPackage {
-    const static unsigned kMaxNumChars = (1 << 30); // tunable
+    const static int64_t kMaxNumChars = (1 << 28); // tunable
+    const static int kCharsPerWord = 16;
+    const static int kNumPaddingWords = 16; // zero words after the last contig, s.t. windows of words can be read past its end
 
-    std::string seqs;
+    // 2 bits per base, each contig reversed (as the edges cut from it) with its last base in the highest bits
+    // of a new word
+    std::vector<edge_word_t> packed_seqs;
     std::vector<int> seq_lengths;
-    std::vector<int> start_pos;
+    std::vector<int64_t> start_word;
     std::vector<multi_t> multiplicity;
-    int cur_pos;
+    int64_t total_length;
 
-    void ReadContigs(FastxReader &fastx_reader, std::string &seq_buffer, char *dna_map) {
+    // if header_buffer is not NULL, the multiplicities are parsed from the "_multi_<m>" of the contig headers,
+    // instead of read by ReadMultiplicity()
+    void ReadContigs(FastxReader &fastx_reader, std::string &seq_buffer, char *dna_map, std::string *header_buffer = NULL) {
         clear();
         while (!fastx_reader.eof()) {
-            fastx_reader.NextSeq(seq_buffer);
+            fastx_reader.NextSeq(seq_buffer, header_buffer);
             if (seq_buffer.length() == 0) {
                 continue;
             }
+            if (header_buffer != NULL) {
+                size_t multi_pos = header_buffer->find("_multi_");
+                assert(multi_pos != std::string::npos);
+                multiplicity.push_back(atoi(header_buffer->c_str() + multi_pos + 7));
+            }
+            start_word.push_back(packed_seqs.size());
+            edge_word_t w = 0;
             for (unsigned i = 0; i < seq_buffer.size(); ++i) {
-                seq_buffer[i] = dna_map[(uint8_t)seq_buffer[i]];
+                w = (w << 2) | dna_map[(uint8_t)seq_buffer[seq_buffer.size() - 1 - i]];
+                if (i % kCharsPerWord == kCharsPerWord - 1) {
+                    packed_seqs.push_back(w);
+                    w = 0;
+                }
+            }
+            if (seq_buffer.size() % kCharsPerWord != 0) {
+                packed_seqs.push_back(w << (kCharsPerWord - seq_buffer.size() % kCharsPerWord) * 2);
             }
-            start_pos.push_back(seqs.size());
-            seqs.append(seq_buffer);
             seq_lengths.push_back(seq_buffer.length());
-            if (seqs.length() >= kMaxNumChars) {
+            total_length += seq_buffer.length();
+            if (total_length >= kMaxNumChars) {
                 break;
             }
         }
+        packed_seqs.resize(packed_seqs.size() + kNumPaddingWords, 0);
     }
 
     void ReadMultiplicity(gzFile multi_file) {
@@ -64,9 +84,11 @@ struct ContigPackage {
     }
 
     void clear() {
-        seqs.clear();
+        packed_seqs.clear();
         seq_lengths.clear();
-        start_pos.clear();
+        start_word.clear();
+        multiplicity.clear();
+        total_length = 0;
     }
 
     size_t size() {
@@ -74,11 +96,16 @@ struct ContigPackage {
     }
 
     char CharAt(int i, int j) {
-        return seqs[start_pos[i] + j];
+        j = seq_lengths[i] - 1 - j;
+        return (packed_seqs[start_word[i] + j / kCharsPerWord] >> (kCharsPerWord - 1 - j % kCharsPerWord) * 2) & 3;
     }
 
     std::string GetString(int i) {
-        return seqs.substr(start_pos[i], seq_lengths[i]);
+        std::string s(seq_lengths[i], 0);
+        for (int j = 0; j < seq_lengths[i]; ++j) {
+            s[j] = CharAt(i, j);
+        }
+        return s;
     }
 };
 
@@ -27,33 +27,50 @@
 #include <iostream>
 #include <sstream>
 #include <algorithm>
+#include <limits>
+#include <parallel/algorithm>
 #include <stdexcept>
+#include <sys/stat.h>
 #include "definitions.h"
 #include "fastx_reader.h"
 #include "io-utility.h"
 #include "options_description.h"
 #include "atomic_bit_vector.h"
+#include "hash.h"
+#include "kmer_iterator.h"
+#include "timer.h"
+#include "megahit_core.h"
 
 using std::string;
 using std::vector;
 
 static void InitGlobalData(IterateGlobalData &globals);
 static void ClearGlobalData(IterateGlobalData &globals);
-static void ReadContigsAndBuildHash(IterateGlobalData &globals, bool is_addi_contigs);
-static void ReadReadsAndProcess(IterateGlobalData &globals);
-
-struct Options {
+static gzFile OpenMultiFile(const string &file_name);
+static bool ChecksumFile(const string &file_name, uint64_t &checksum);
+template <uint32_t kNumUint64>
+static void ReadContigsAndBuildHash(IterateGlobalData &globals, IterateKmerTables<kNumUint64> &tables, bool is_addi_contigs);
+template <uint32_t kNumUint64>
+static void BuildCrusialFilter(IterateKmerTables<kNumUint64> &tables);
+template <uint32_t kNumUint64>
+static void ReadReadsAndProcess(IterateGlobalData &globals, IterateKmerTables<kNumUint64> &tables);
+template <uint32_t kNumUint64>
+static void Iterate(IterateGlobalData &globals);
+
+static struct Options {
     string contigs_file;
     string contigs_multi_file;
     string addi_contig_file;
     string addi_multi_file;
     string read_file;
     string read_format;
+    string read_ids_file;
     int num_cpu_threads;
     int kmer_k;
     int step;
     int max_read_len;
     string output_prefix;
+    string kmer_index_file;
 
     Options() {
         read_format = "";
@@ -76,27 +93,27 @@ static void ParseOptions(int argc, char *argv[]) {
     OptionsDescription desc;
 
     desc.AddOption("contigs_file", "c", options.contigs_file, "(*) contigs file, fasta/fastq format, output by assembler");
-    desc.AddOption("multi_file", "m", options.contigs_multi_file, "(*) contigs's multiplicity file output by assembler");
+    desc.AddOption("multi_file", "m", options.contigs_multi_file, "contigs's multiplicity file output by assembler. If not given, the multiplicities are parsed from the contig headers, e.g. when the contigs are streamed through a fifo");
     desc.AddOption("addi_contig_file", "", options.addi_contig_file, "additional contigs file, fasta/fastq format, output by assembler if remove low local");
-    desc.AddOption("addi_multi_file", "", options.addi_multi_file, "contigs's multiplicity file, output by assembler if remove low local");
+    desc.AddOption("addi_multi_file", "", options.addi_multi_file, "contigs's multiplicity file, output by assembler if remove low local. Parsed from the headers if not given");
     desc.AddOption("read_file", "r", options.read_file, "(*) reads to be aligned. \"-\" for stdin. Can be gzip'ed.");
     desc.AddOption("read_format", "f", options.read_format, "(*) reads' format. fasta, fastq or binary.");
+    desc.AddOption("read_ids_file", "", options.read_ids_file, "runs of ids of the binary reads to be aligned, output by the last iteration. All reads if not given.");
     desc.AddOption("num_cpu_threads", "t", options.num_cpu_threads, "number of cpu threads, at least 2. 0 for auto detect.");
     desc.AddOption("kmer_k", "k", options.kmer_k, "(*) current kmer size.");
     desc.AddOption("step", "s", options.step, "(*) step for iteration (<= 29). i.e. this iteration is from kmer_k to (kmer_k + step)");
-    desc.AddOption("output_prefix", "o", options.output_prefix, "(*) output_prefix.edges.0 and output_prefix.rr.pb will be created.");
+    desc.AddOption("output_prefix", "o", options.output_prefix, "(*) output_prefix.edges.0 and output_prefix.rr.ids will be created, and output_prefix.rr.pb if reads are not binary.");
     desc.AddOption("max_read_len", "l", options.max_read_len, "(*) max read length of all reads.");
+    desc.AddOption("kmer_index", "", options.kmer_index_file, "file of the index of the contigs' k-mers. It is loaded if saved for the same contigs, k and step, and is built and saved otherwise. The contigs file must be a regular file.");
 
     try {
         desc.Parse(argc, argv);
-        if (options.step + options.kmer_k >= (int)Kmer<KMER_NUM_UINT64>::max_size()) {
+        if (options.step + options.kmer_k >= (int)Kmer<kMaxKmerNumUint64>::max_size()) {
             std::ostringstream os;
-            os << "kmer_k + step must less than " << Kmer<KMER_NUM_UINT64>::max_size();
+            os << "kmer_k + step must less than " << Kmer<kMaxKmerNumUint64>::max_size();
             throw std::logic_error(os.str());
         } else if (options.contigs_file == "") {
             throw std::logic_error("No contig file!");
-        } else if (options.contigs_multi_file == "") {
-            throw std::logic_error("No contig's multiplicity file!");
         } else if (options.read_file == "") {
             throw std::logic_error("No reads file!");
         } else if (options.kmer_k <= 0) {
@@ -107,6 +124,8 @@ static void ParseOptions(int argc, char *argv[]) {
             throw std::logic_error("No output prefix!");
         } else if (options.read_format != "binary" && options.read_format != "fasta" && options.read_format != "fastq") {
             throw std::logic_error("Invalid read format!");
+        } else if (options.read_ids_file != "" && options.read_format != "binary") {
+            throw std::logic_error("Read ids are only for binary reads!");
         } else if (options.max_read_len == 0) {
             throw std::logic_error("Invalid max read length!");
         }
@@ -124,20 +143,29 @@ static void ParseOptions(int argc, char *argv[]) {
     }
 }
 
-int main(int argc, char *argv[]) {
+int main_iterate_edges(int argc, char *argv[]) {
     // set stdout line buffered
     setvbuf(stdout, NULL, _IONBF, 0);
     setvbuf(stderr, NULL, _IONBF, 0);
 
+    options = Options();
     ParseOptions(argc, argv);
     IterateGlobalData globals;
 
     InitGlobalData(globals);
-    ReadContigsAndBuildHash(globals, false);
-    if (options.addi_multi_file != "") {
-        ReadContigsAndBuildHash(globals, true);
+    // use the fewest words that can hold a (k+s+1)-mer
+    int next_k1 = globals.kmer_k + globals.step + 1;
+    if (next_k1 <= (int)Kmer<1>::max_size()) {
+        Iterate<1>(globals);
+    } else if (next_k1 <= (int)Kmer<2>::max_size()) {
+        Iterate<2>(globals);
+    } else if (next_k1 <= (int)Kmer<3>::max_size()) {
+        Iterate<3>(globals);
+    } else if (next_k1 <= (int)Kmer<4>::max_size()) {
+        Iterate<4>(globals);
+    } else {
+        Iterate<kMaxKmerNumUint64>(globals);
     }
-    ReadReadsAndProcess(globals);
     ClearGlobalData(globals);
     return 0;
 }
@@ -171,7 +199,7 @@ static void InitGlobalData(IterateGlobalData &globals) {
     }
 
     globals.contigs_file = gzopen(options.contigs_file.c_str(), "r");
-    globals.contigs_multi_file = gzopen(options.contigs_multi_file.c_str(), "r");
+    globals.contigs_multi_file = OpenMultiFile(options.contigs_multi_file);
 
     if (string(options.read_file) == "-") {
         globals.read_file = gzdopen(fileno(stdin), "r");
@@ -179,34 +207,95 @@ static void InitGlobalData(IterateGlobalData &globals) {
         globals.read_file = gzopen(options.read_file.c_str(), "r");
     }
     assert(globals.contigs_file != NULL);
-    assert(globals.contigs_multi_file != NULL);
     assert(globals.read_file != NULL);
 
-    if (options.addi_contig_file != "") {
-        globals.addi_contig_file = gzopen(options.addi_contig_file.c_str(), "r");
-        globals.addi_multi_file = gzopen(options.addi_multi_file.c_str(), "r");
-        assert(globals.addi_multi_file != NULL);
-        assert(globals.addi_contig_file != NULL);
+    // the additional contigs are opened after all contigs are read, as the assembler may still be writing them
+    globals.addi_contig_file = NULL;
+    globals.addi_multi_file = NULL;
+
+    // the binary reads are written once, and later iterations only record which of them remain
+    if (options.read_ids_file != "") {
+        globals.read_ids_file = gzopen(options.read_ids_file.c_str(), "r");
+        assert(globals.read_ids_file != NULL);
+        globals.read_run_start = 0;
+        globals.read_run_length = 0;
     } else {
-        globals.addi_contig_file = NULL;
-        globals.addi_multi_file = NULL;
+        globals.read_ids_file = NULL;
+        globals.read_run_start = 0;
+        globals.read_run_length = std::numeric_limits<int64_t>::max();
     }
 
     globals.output_edge_file = OpenFileAndCheck((string(options.output_prefix) + ".edges.0").c_str(), "wb");
-    globals.output_read_file = OpenFileAndCheck((string(options.output_prefix) + ".rr.pb").c_str(), "wb"); // remaining reads packed binary
+    if (globals.read_format != IterateGlobalData::kBinary) {
+        globals.output_read_file = OpenFileAndCheck((string(options.output_prefix) + ".rr.pb").c_str(), "wb"); // remaining reads packed binary
+        assert(globals.output_read_file != NULL);
+    } else {
+        globals.output_read_file = NULL;
+    }
+    globals.output_read_ids_file = OpenFileAndCheck((string(options.output_prefix) + ".rr.ids").c_str(), "wb");
     assert(globals.output_edge_file != NULL);
-    assert(globals.output_read_file != NULL);
+    assert(globals.output_read_ids_file != NULL);
+    globals.output_run_start = 0;
+    globals.output_run_length = 0;
 }
 
 static void ClearGlobalData(IterateGlobalData &globals) {
     gzclose(globals.contigs_file);
+    if (globals.contigs_multi_file != NULL) {
+        gzclose(globals.contigs_multi_file);
+    }
     gzclose(globals.read_file);
     if (globals.addi_contig_file != NULL) {
         gzclose(globals.addi_contig_file);
+    }
+    if (globals.addi_multi_file != NULL) {
         gzclose(globals.addi_multi_file);
     }
+    if (globals.read_ids_file != NULL) {
+        gzclose(globals.read_ids_file);
+    }
     fclose(globals.output_edge_file);
-    fclose(globals.output_read_file);
+    if (globals.output_read_file != NULL) {
+        fclose(globals.output_read_file);
+    }
+    fclose(globals.output_read_ids_file);
+}
+
+static const size_t kEdgesPerWrite = 1 << 20;
+
+// NULL if no multiplicity file is given
+static gzFile OpenMultiFile(const string &file_name) {
+    if (file_name == "") {
+        return NULL;
+    }
+    gzFile multi_file = gzopen(file_name.c_str(), "r");
+    assert(multi_file != NULL);
+    return multi_file;
+}
+
+// a hash of the bytes of a regular file; false if it is not one, e.g. a fifo, which cannot be read twice
+static bool ChecksumFile(const string &file_name, uint64_t &checksum) {
+    struct stat file_stat;
+    if (stat(file_name.c_str(), &file_stat) != 0 || !S_ISREG(file_stat.st_mode)) {
+        return false;
+    }
+    FILE *file = fopen(file_name.c_str(), "rb");
+    if (file == NULL) {
+        return false;
+    }
+
+    static const size_t kWordsPerChunk = 1 << 16;
+    vector<uint64_t> buffer(kWordsPerChunk);
+    checksum = file_stat.st_size;
+    size_t num_bytes;
+    do {
+        std::fill(buffer.begin(), buffer.end(), 0);
+        num_bytes = fread(&buffer[0], 1, kWordsPerChunk * sizeof(uint64_t), file);
+        checksum = HashMix(checksum ^ HashWords(&buffer[0], (num_bytes + 7) / 8));
+    } while (num_bytes == kWordsPerChunk * sizeof(uint64_t));
+    bool ok = !ferror(file);
+    fclose(file);
+    return ok;
 }
 
 struct ReadContigsThreadData {
@@ -226,25 +315,41 @@ static void* ReadContigsThread(void* data) {
     char *dna_map = globals.dna_map;
 
     printf("Reading contigs...\n");
-    package.ReadContigs(fastx_reader, seq_buffer, dna_map);
-    package.ReadMultiplicity(multi_file);
-    printf("Read %lu contigs, total length: %lu\n", package.size(), package.seqs.length());
+    if (multi_file != NULL) {
+        package.ReadContigs(fastx_reader, seq_buffer, dna_map);
+        package.ReadMultiplicity(multi_file);
+    } else {
+        string header_buffer;
+        package.ReadContigs(fastx_reader, seq_buffer, dna_map, &header_buffer);
+    }
+    printf("Read %lu contigs, total length: %lld\n", package.size(), (long long)package.total_length);
     return NULL;
 }
 
-static void ReadContigsAndBuildHash(IterateGlobalData &globals, bool is_addi_contigs) {
+template <uint32_t kNumUint64>
+static void ReadContigsAndBuildHash(IterateGlobalData &globals, IterateKmerTables<kNumUint64> &tables, bool is_addi_contigs) {
     ContigPackage packages[2];
     string seq_buffer;
     FastxReader fastx_reader;
     if (is_addi_contigs) {
+        globals.addi_contig_file = gzopen(options.addi_contig_file.c_str(), "r");
+        assert(globals.addi_contig_file != NULL);
+        globals.addi_multi_file = OpenMultiFile(options.addi_multi_file);
         fastx_reader.init(globals.addi_contig_file);
     } else {
         fastx_reader.init(globals.contigs_file);
     }
     int input_thread_index = 0;
     bool is_first_round = !is_addi_contigs;
-    static const int kWordsPerEdge = ((globals.kmer_k + globals.step + 1) * kBitsPerEdgeChar + kBitsPerMulti_t + 31) / 32;
-    uint32_t packed_edge[kWordsPerEdge];
+    const int kWordsPerEdge = ((globals.kmer_k + globals.step + 1) * kBitsPerEdgeChar + kBitsPerMulti_t + 31) / 32;
+    vector<int64_t> edge_offsets;
+    vector<uint32_t> packed_edges;
+    // the bits of the bases in each word of a packed edge
+    vector<uint32_t> edge_masks(kWordsPerEdge);
+    for (int w = 0; w < kWordsPerEdge; ++w) {
+        int num_bits = std::min(32, std::max(0, (globals.kmer_k + globals.step + 1) * kBitsPerEdgeChar - w * 32));
+        edge_masks[w] = num_bits == 0 ? 0 : ~uint32_t(0) << (32 - num_bits);
+    }
 
     pthread_t input_thread;
     ReadContigsThreadData input_thread_data;
@@ -272,14 +377,17 @@ static void ReadContigsAndBuildHash(IterateGlobalData &globals, bool is_addi_con
         pthread_create(&input_thread, NULL, ReadContigsThread, &input_thread_data);
         ContigPackage &cur_package = packages[input_thread_index ^ 1];
 
-        if (!is_addi_contigs) {
+        if (!is_addi_contigs && !globals.crusial_kmers_loaded) {
+            // each contig adds at most two crusial k-mers; sizing the table for them here keeps
+            // it from growing while the threads insert
+            tables.crusial_kmers.reserve(tables.crusial_kmers.size() + 2 * cur_package.size());
 #pragma omp parallel for
             for (unsigned i = 0; i < cur_package.size(); ++i) {
                 if (cur_package.seq_lengths[i] < globals.kmer_k) {
                     continue;
                 }
 
-                Kmer<KMER_NUM_UINT64> kmer(globals.kmer_k);
+                Kmer<kNumUint64> kmer(globals.kmer_k);
                 for (int j = 0; j < globals.kmer_k; ++j) {
                     kmer.ShiftAppend(cur_package.CharAt(i, j));
                 }
@@ -289,20 +397,20 @@ static void ReadContigsAndBuildHash(IterateGlobalData &globals, bool is_addi_con
                     s_seq |= uint64_t(cur_package.CharAt(i, j + globals.kmer_k)) << (31 - j) * 2;
                 }
                 s_seq |= s_length;
-                globals.crusial_kmers[kmer] = s_seq;
+                tables.crusial_kmers.set(kmer, s_seq);
 
                 if (cur_package.seq_lengths[i] > globals.kmer_k) {
                     for (int j = 0; j < globals.kmer_k; ++j) {
                         kmer.ShiftAppend(3 - cur_package.CharAt(i, cur_package.seq_lengths[i] - 1 - j));
                     }
-                    // assert(globals.crusial_kmers.find(kmer) == globals.crusial_kmers.end());
+                    // assert(tables.crusial_kmers.find(kmer) == tables.crusial_kmers.end());
 
                     s_seq = 0;
                     for (int j = 0; j < globals.step && j < s_length; ++j) {
                         s_seq |= uint64_t(3 - cur_package.CharAt(i, cur_package.seq_lengths[i] - globals.kmer_k - 1 - j)) << (31 - j) * 2;
                     }
                     s_seq |= s_length;
-                    globals.crusial_kmers[kmer] = s_seq;
+                    tables.crusial_kmers.set(kmer, s_seq);
                 }
             }
         }
@@ -314,100 +422,274 @@ static void ReadContigsAndBuildHash(IterateGlobalData &globals, bool is_addi_con
             is_first_round = false;
         }
 
+        // the (k+s+1)-mers (reversed) are cut from the packed contigs word by word; contigs are processed in batches
+        // whose edges are packed in parallel into one buffer and written at once
         int next_k = globals.kmer_k + globals.step;
-        int last_shift = (next_k + 1) % 16;
-        last_shift = (last_shift == 0 ? 0 : 16 - last_shift) * 2;
-        for (unsigned i = 0; i < cur_package.size(); ++i) {
-            if (cur_package.seq_lengths[i] < next_k + 1) {
-                continue;
+        for (unsigned batch_begin = 0, batch_end; batch_begin < cur_package.size(); batch_begin = batch_end) {
+            edge_offsets.resize(1);
+            for (batch_end = batch_begin; batch_end < cur_package.size(); ++batch_end) {
+                int64_t num_edges = std::max(0, cur_package.seq_lengths[batch_end] - next_k);
+                if (batch_end > batch_begin && edge_offsets.back() + num_edges > (int64_t)kEdgesPerWrite) {
+                    break;
+                }
+                edge_offsets.push_back(edge_offsets.back() + num_edges);
             }
+            packed_edges.resize(edge_offsets.back() * kWordsPerEdge);
 
-            double multiplicity_prev = cur_package.multiplicity[i];
-            uint16_t multiplicity;
-            // convert the multiplicity from k to k+s+1
-            {
-                int num_kmer = cur_package.seq_lengths[i] - globals.kmer_k + 1;
-                int num_nextk1 = cur_package.seq_lengths[i] - (next_k + 1) + 1;
-                int internal_max = std::min(next_k + 1 - globals.kmer_k + 1, num_nextk1);
-                int num_external = internal_max - 1;
-                int num_internal = num_kmer - num_external * 2;
-
-                double exp_num_kmer = (double)num_external * (num_external + 1) / (next_k + 1 - globals.kmer_k + 1)
-                                      + (double)internal_max / (next_k + 1 - globals.kmer_k + 1) * num_internal;
-                exp_num_kmer *= multiplicity_prev;
-                multiplicity = std::min(int(exp_num_kmer * globals.kmer_k / (next_k + 1) / num_nextk1 + 0.5), kMaxMulti_t);
-            }
+#pragma omp parallel for
+            for (unsigned i = batch_begin; i < batch_end; ++i) {
+                if (cur_package.seq_lengths[i] < next_k + 1) {
+                    continue;
+                }
 
-            memset(packed_edge, 0, sizeof(uint32_t) * kWordsPerEdge);
+                double multiplicity_prev = cur_package.multiplicity[i];
+                uint16_t multiplicity;
+                // convert the multiplicity from k to k+s+1
+                {
+                    int num_kmer = cur_package.seq_lengths[i] - globals.kmer_k + 1;
+                    int num_nextk1 = cur_package.seq_lengths[i] - (next_k + 1) + 1;
+                    int internal_max = std::min(next_k + 1 - globals.kmer_k + 1, num_nextk1);
+                    int num_external = internal_max - 1;
+                    int num_internal = num_kmer - num_external * 2;
+
+                    double exp_num_kmer = (double)num_external * (num_external + 1) / (next_k + 1 - globals.kmer_k + 1)
+                                          + (double)internal_max / (next_k + 1 - globals.kmer_k + 1) * num_internal;
+                    exp_num_kmer *= multiplicity_prev;
+                    multiplicity = std::min(int(exp_num_kmer * globals.kmer_k / (next_k + 1) / num_nextk1 + 0.5), kMaxMulti_t);
+                }
 
-            int w = 0;
-            int end_word = 0;
-            for (int j = 0; j < next_k + 1; ) {
-                w = (w << 2) | cur_package.CharAt(i, next_k - j);
-                ++j;
-                if (j % 16 == 0) {
-                    packed_edge[end_word] = w;
-                    w = 0;
-                    end_word++;
+                const edge_word_t *seq = &cur_package.packed_seqs[cur_package.start_word[i]];
+                uint32_t *packed_edge = &packed_edges[edge_offsets[i - batch_begin] * kWordsPerEdge];
+                for (int j = cur_package.seq_lengths[i] - (next_k + 1); j >= 0; --j) {
+                    const edge_word_t *first_word = seq + j / ContigPackage::kCharsPerWord;
+                    int shift = j % ContigPackage::kCharsPerWord * 2;
+                    for (int w = 0; w < kWordsPerEdge; ++w) {
+                        packed_edge[w] = shift == 0 ? first_word[w] : (first_word[w] << shift) | (first_word[w + 1] >> (32 - shift));
+                        packed_edge[w] &= edge_masks[w];
+                    }
+                    packed_edge[kWordsPerEdge - 1] |= multiplicity;
+                    packed_edge += kWordsPerEdge;
                 }
             }
-            packed_edge[end_word] = (w << last_shift);
-            packed_edge[kWordsPerEdge - 1] |= multiplicity;
 
-            fwrite(packed_edge, sizeof(uint32_t), kWordsPerEdge, globals.output_edge_file);
+            fwrite(packed_edges.data(), sizeof(uint32_t), packed_edges.size(), globals.output_edge_file);
+        }
+    }
+    printf("Number of crusial kmers: %lu\n", tables.crusial_kmers.size());
+}
 
-            for (int j = next_k + 1; j < cur_package.seq_lengths[i]; ++j) {
-                packed_edge[kWordsPerEdge - 1] ^= multiplicity;
-                packed_edge[next_k / 16] &= ~(3 << (15 - next_k % 16) * 2);
-                for (int k = kWordsPerEdge - 1; k > 0; --k) {
-                    packed_edge[k] >>= 2;
-                    packed_edge[k] |= packed_edge[k - 1] << 30;
-                }
-                packed_edge[0] >>= 2;
-                packed_edge[0] |= cur_package.CharAt(i, j) << 30;
-                assert((packed_edge[kWordsPerEdge - 1] & kMaxMulti_t) == 0);
-                packed_edge[kWordsPerEdge - 1] |= multiplicity;
-                fwrite(packed_edge, sizeof(uint32_t), kWordsPerEdge, globals.output_edge_file);
-            }
+template <uint32_t kNumUint64>
+static void BuildCrusialFilter(IterateKmerTables<kNumUint64> &tables) {
+    tables.crusial_filter.reset(tables.crusial_kmers.size());
+#pragma omp parallel for
+    for (size_t i = 0; i < tables.crusial_kmers.capacity(); ++i) {
+        if (tables.crusial_kmers.is_occupied(i)) {
+            tables.crusial_filter.insert(tables.crusial_kmers.key_at(i));
         }
     }
-    printf("Number of crusial kmers: %lu\n", globals.crusial_kmers.size());
 }
 
+static const int kNumEdgePartitions = 64;
+static const int64_t kReadsPerBatch = 1 << 16; // number of reads aligned between two rounds of edge counting
+
+// the order of Kmer is the lexical order of its packed edge
+template <uint32_t kNumUint64>
+struct CompareEdgeSlots {
+    const KmerHashMap<kNumUint64, multi_t> &edges;
+    CompareEdgeSlots(const KmerHashMap<kNumUint64, multi_t> &edges): edges(edges) {}
+    bool operator() (size_t a, size_t b) const {
+        return edges.key_at(a) < edges.key_at(b);
+    }
+};
+
 struct ReadReadsThreadData {
     ReadPackage *read_package;
+    vector<int64_t> *read_ids;
     FastxReader *fastx_reader;
     string *seq_buffer;
     IterateGlobalData *globals;
 };
 
+// read the binary reads of the runs in read_ids_file (of all reads if it is not given),
+// until the package is full; their ids are appended to read_ids
+static void ReadBinaryReadsByIds(IterateGlobalData &globals, ReadPackage &package, vector<int64_t> &read_ids) {
+    int64_t bytes_per_read = sizeof(edge_word_t) * package.words_per_read;
+    while (package.num_of_reads < package.kMaxNumReads) {
+        if (globals.read_run_length == 0) {
+            int64_t run[2]; // first id, number of ids
+            if (gzread(globals.read_ids_file, run, sizeof(run)) != sizeof(run)) {
+                break;
+            }
+            globals.read_run_start = run[0];
+            globals.read_run_length = run[1];
+            gzseek(globals.read_file, run[0] * bytes_per_read, SEEK_SET);
+        }
+
+        int64_t num_reads = std::min(globals.read_run_length, package.kMaxNumReads - package.num_of_reads);
+        int num_bytes = gzread(globals.read_file, package.GetReadPtr(package.num_of_reads), num_reads * bytes_per_read);
+        assert(num_bytes >= 0 && num_bytes % bytes_per_read == 0);
+        int64_t num_read = num_bytes / bytes_per_read;
+        for (int64_t i = 0; i < num_read; ++i) {
+            read_ids.push_back(globals.read_run_start + i);
+        }
+        package.num_of_reads += num_read;
+        globals.read_run_start += num_read;
+        globals.read_run_length -= num_read;
+
+        if (num_read < num_reads) {
+            if (globals.read_ids_file != NULL) {
+                fprintf(stderr, "Read ids out of range of the binary reads!\n");
+                exit(1);
+            }
+            break;
+        }
+    }
+}
+
+// the ids of aligned reads are written as runs of consecutive ids
+static void FlushAlignedReadIds(IterateGlobalData &globals) {
+    if (globals.output_run_length > 0) {
+        int64_t run[2] = {globals.output_run_start, globals.output_run_length};
+        fwrite(run, sizeof(int64_t), 2, globals.output_read_ids_file);
+        globals.output_run_length = 0;
+    }
+}
+
+static void AppendAlignedReadId(IterateGlobalData &globals, int64_t read_id) {
+    if (globals.output_run_length > 0 && globals.output_run_start + globals.output_run_length == read_id) {
+        ++globals.output_run_length;
+        return;
+    }
+    FlushAlignedReadIds(globals);
+    globals.output_run_start = read_id;
+    globals.output_run_length = 1;
+}
+
 static void* ReadReadsThread(void* data) {
     ReadPackage &package = *(((ReadReadsThreadData*)data)->read_package);
+    vector<int64_t> &read_ids = *(((ReadReadsThreadData*)data)->read_ids);
     string &seq_buffer = *(((ReadReadsThreadData*)data)->seq_buffer);
     IterateGlobalData &globals = *(((ReadReadsThreadData*)data)->globals);
     FastxReader &fastx_reader = *(((ReadReadsThreadData*)data)->fastx_reader);
     package.clear();
+    read_ids.clear();
 
     if (globals.read_format == IterateGlobalData::kFastq || globals.read_format == IterateGlobalData::kFasta) {
         package.ReadFastxReads(fastx_reader, seq_buffer, globals.dna_map);
     } else {
-        package.ReadBinaryReads(globals.read_file);
+        ReadBinaryReadsByIds(globals, package, read_ids);
     }
     return NULL;
 }
 
-static void ReadReadsAndProcess(IterateGlobalData &globals) {
+// find the (k+s+1)-mers of a read that are supported by the crusial k-mers, and append them
+// to the partitions of the calling thread; returns whether any of them is found.
+// kmer_exist is a scratch buffer of the calling thread, reused across its reads
+template <uint32_t kNumUint64>
+static bool AlignRead(IterateGlobalData &globals, IterateKmerTables<kNumUint64> &tables, ReadPackage &package, int64_t read_id,
+                      vector<uint8_t> &kmer_exist, vector<Kmer<kNumUint64> > *edge_partitions) {
+    int length = package.length(read_id);
+    assert(length <= package.max_read_len);
+    if (length < globals.kmer_k + globals.step + 1) {
+        return false;
+    }
+
+    kmer_exist.assign(length, 0);
+    int last_marked_pos = -1;
+    KmerIterator<kNumUint64> kmer_iter(globals.kmer_k);
+    for (int j = 0; j < globals.kmer_k; ++j) {
+        kmer_iter.push_back(package.CharAt(read_id, j));
+    }
+
+    // positions covered by an extension are already marked and not probed again, and the strands
+    // rejected by the filter are not probed at all; the k-mer of the next position is rolled one step
+    // ahead so that the slots of its probes can be prefetched
+    bool may_exist = tables.crusial_filter.may_contain(kmer_iter.forward());
+    bool rev_may_exist = tables.crusial_filter.may_contain(kmer_iter.reverse_complement());
+    for (int cur_pos = 0; cur_pos + globals.kmer_k <= length; ++cur_pos) {
+        KmerIterator<kNumUint64> next_iter(kmer_iter);
+        bool next_may_exist = false, next_rev_may_exist = false;
+        if (cur_pos + globals.kmer_k < length) {
+            next_iter.push_back(package.CharAt(read_id, cur_pos + globals.kmer_k));
+            if (!kmer_exist[cur_pos + 1]) {
+                if ((next_may_exist = tables.crusial_filter.may_contain(next_iter.forward()))) {
+                    tables.crusial_kmers.prefetch(next_iter.forward());
+                }
+                if ((next_rev_may_exist = tables.crusial_filter.may_contain(next_iter.reverse_complement()))) {
+                    tables.crusial_kmers.prefetch(next_iter.reverse_complement());
+                }
+            }
+        }
+
+        if (!kmer_exist[cur_pos] && (may_exist || rev_may_exist)) {
+            uint64_t *s_seq_ptr = may_exist ? tables.crusial_kmers.find(kmer_iter.forward()) : NULL;
+            if (s_seq_ptr != NULL) {
+                kmer_exist[cur_pos] = 1;
+                int64_t s_seq = *s_seq_ptr;
+                int s_seq_length = s_seq & 63;
+                int j;
+                for (j = 0; j < s_seq_length && cur_pos + globals.kmer_k + j < length; ++j) {
+                    if (package.CharAt(read_id, cur_pos + globals.kmer_k + j) == ((s_seq >> (31 - j) * 2) & 3)) {
+                        kmer_exist[cur_pos + j + 1] = 1;
+                    } else {
+                        break;
+                    }
+                }
+                last_marked_pos = cur_pos + j;
+            } else if (rev_may_exist && (s_seq_ptr = tables.crusial_kmers.find(kmer_iter.reverse_complement())) != NULL) {
+                kmer_exist[cur_pos] = 1;
+                int64_t s_seq = *s_seq_ptr;
+                int s_seq_length = s_seq & 63;
+                for (int j = 0; j < s_seq_length && cur_pos - 1 - j > last_marked_pos; ++j) {
+                    if (3 - package.CharAt(read_id, cur_pos - 1 - j) == ((s_seq >> (31 - j) * 2) & 3)) {
+                        kmer_exist[cur_pos - 1 - j] = 1;
+                    } else {
+                        break;
+                    }
+                }
+            }
+        }
+
+        kmer_iter = next_iter;
+        may_exist = next_may_exist;
+        rev_may_exist = next_rev_may_exist;
+    }
+
+    // both strands are rolled over the bases that are not yet in the window, at most k+s+1 of them
+    bool aligned = false;
+    int edge_k = globals.kmer_k + globals.step + 1;
+    KmerIterator<kNumUint64> edge_iter(edge_k);
+    for (int j = 0, last_j = -globals.kmer_k, acc_exist = 0; j + globals.kmer_k <= length; ++j) {
+        acc_exist = kmer_exist[j] ? acc_exist + 1 : 0;
+
+        if (acc_exist >= globals.step + 2) {
+            for (int x = std::max(last_j + globals.kmer_k, j + globals.kmer_k - edge_k); x < j + globals.kmer_k; ++x) {
+                edge_iter.push_back(package.CharAt(read_id, x));
+            }
+
+            const Kmer<kNumUint64> &edge = edge_iter.canonical();
+            edge_partitions[edge.hash() % kNumEdgePartitions].push_back(edge);
+            last_j = j;
+            aligned = true;
+        }
+    }
+    return aligned;
+}
+
+template <uint32_t kNumUint64>
+static void ReadReadsAndProcess(IterateGlobalData &globals, IterateKmerTables<kNumUint64> &tables) {
     ReadPackage packages[2];
     packages[0].init(globals.max_read_len);
     packages[1].init(globals.max_read_len);
+    vector<int64_t> read_ids[2];
+    int64_t num_stored_reads = 0;
     string seq_buffer;
     FastxReader fastx_reader;
     if (globals.read_format != IterateGlobalData::kBinary) {
         fastx_reader.init(globals.read_file);
     }
     int input_thread_index = 0;
-    static const int kWordsPerEdge = ((globals.kmer_k + globals.step + 1) * 2 + kBitsPerMulti_t + 31) / 32;
-    uint32_t packed_edge[kWordsPerEdge];
+    const int kWordsPerEdge = ((globals.kmer_k + globals.step + 1) * 2 + kBitsPerMulti_t + 31) / 32;
 
     int64_t num_aligned_reads = 0;
     int64_t num_total_reads = 0;
@@ -415,14 +697,19 @@ static void ReadReadsAndProcess(IterateGlobalData &globals) {
     pthread_t input_thread;
     ReadReadsThreadData input_thread_data;
     input_thread_data.read_package = &packages[input_thread_index];
+    input_thread_data.read_ids = &read_ids[input_thread_index];
     input_thread_data.fastx_reader = &fastx_reader;
     input_thread_data.seq_buffer = &seq_buffer;
     input_thread_data.globals = &globals;
 
     pthread_create(&input_thread, NULL, ReadReadsThread, &input_thread_data);
-    globals.iterative_edges.reserve(globals.crusial_kmers.size() * 10);
+    tables.iterative_edges.reserve(tables.crusial_kmers.size() * 10);
     AtomicBitVector is_aligned;
     omp_set_num_threads(globals.num_cpu_threads - 1);
+    int num_threads = omp_get_max_threads();
+    vector<vector<Kmer<kNumUint64> > > edge_partitions(num_threads * kNumEdgePartitions);
+    vector<vector<uint8_t> > kmer_exist(num_threads);
+    xtimer_t align_timer;
 
     while (true) {
         pthread_join(input_thread, NULL);
@@ -432,156 +719,139 @@ static void ReadReadsAndProcess(IterateGlobalData &globals) {
 
         input_thread_index ^= 1;
         input_thread_data.read_package = &packages[input_thread_index];
+        input_thread_data.read_ids = &read_ids[input_thread_index];
         pthread_create(&input_thread, NULL, ReadReadsThread, &input_thread_data);
         ReadPackage &cur_package = packages[input_thread_index ^ 1];
+        vector<int64_t> &cur_read_ids = read_ids[input_thread_index ^ 1];
         is_aligned.reset(cur_package.num_of_reads);
 
-#pragma omp parallel for
-        for (unsigned i = 0; i < (unsigned)cur_package.num_of_reads; ++i) {
-            int length = cur_package.length(i);
-            assert(length <= cur_package.max_read_len);
-            if (length < globals.kmer_k + globals.step + 1) {
-                continue;
-            }
-
-            vector<bool> kmer_exist(length, false);
-            int cur_pos = 0;
-            int last_marked_pos = -1;
-            Kmer<KMER_NUM_UINT64> kmer(globals.kmer_k);
-            for (int j = 0; j < globals.kmer_k; ++j) {
-                kmer.ShiftAppend(cur_package.CharAt(i, j));
-            }
-            Kmer<KMER_NUM_UINT64> rev_kmer(kmer);
-            rev_kmer.ReverseComplement();
-
-            while (cur_pos + globals.kmer_k <= length) {
-                int next_pos = cur_pos + 1;
-                if (!kmer_exist[cur_pos]) {
-                    auto iter = globals.crusial_kmers.find(kmer);
-                    if (iter != globals.crusial_kmers.end()) {
-                        kmer_exist[cur_pos] = true;
-                        int64_t s_seq = iter->second;
-                        int s_seq_length = s_seq & 63;
-                        int j;
-                        for (j = 0; j < s_seq_length && cur_pos + globals.kmer_k + j < length; ++j) {
-                            if (cur_package.CharAt(i, cur_pos + globals.kmer_k + j) == ((s_seq >> (31 - j) * 2) & 3)) {
-                                kmer_exist[cur_pos + j + 1] = true;
-                            } else {
-                                break;
-                            }
-                        }
-
-                        last_marked_pos = cur_pos + j;
-                        next_pos = last_marked_pos + 1;
-                    } else if ((iter = globals.crusial_kmers.find(rev_kmer)) != globals.crusial_kmers.end()) {
-                        kmer_exist[cur_pos] = true;
-                        int64_t s_seq = iter->second;
-                        int s_seq_length = s_seq & 63;
-                        int j;
-                        for (j = 0; j < s_seq_length && cur_pos - 1 - j > last_marked_pos; ++j) {
-                            if (3 - cur_package.CharAt(i, cur_pos - 1 - j) == ((s_seq >> (31 - j) * 2) & 3)) {
-                                kmer_exist[cur_pos - 1 - j] = true;
-                            } else {
-                                break;
-                            }
-                        }
-                    }
-                }
+        for (int64_t batch_begin = 0; batch_begin < cur_package.num_of_reads; batch_begin += kReadsPerBatch) {
+            int64_t batch_end = std::min(batch_begin + kReadsPerBatch, cur_package.num_of_reads);
 
-                if (next_pos + globals.kmer_k <= length) {
-                    while (cur_pos < next_pos) {
-                        ++cur_pos;
-                        uint8_t c = cur_package.CharAt(i, cur_pos + globals.kmer_k - 1);
-                        kmer.ShiftAppend(c);
-                        rev_kmer.ShiftPreappend(3 - c);
-                    }
-                } else {
-                    break;
+            align_timer.start();
+#pragma omp parallel for
+            for (int64_t i = batch_begin; i < batch_end; ++i) {
+                int thread_id = omp_get_thread_num();
+                if (AlignRead(globals, tables, cur_package, i, kmer_exist[thread_id], &edge_partitions[thread_id * kNumEdgePartitions])) {
+                    is_aligned.set(i);
+#pragma omp atomic
+                    ++num_aligned_reads;
                 }
             }
-
-            bool aligned = false;
-            kmer.resize(globals.kmer_k + globals.step + 1);
-            rev_kmer.resize(globals.kmer_k + globals.step + 1);
-            for (int j = 0, last_j = -globals.kmer_k, acc_exist = 0; j + globals.kmer_k <= length; ++j) {
-                acc_exist = kmer_exist[j] ? acc_exist + 1 : 0;
-
-                if (acc_exist >= globals.step + 2) {
-                    if (j - last_j < 8) { // tunable
-                        for (int x = last_j + 1; x <= j; ++x) {
-                            uint8_t c = cur_package.CharAt(i, x + globals.kmer_k - 1);
-                            kmer.ShiftAppend(c);
-                            rev_kmer.ShiftPreappend(3 - c);
-                        }
-                    } else if (j - last_j < globals.kmer_k + globals.step + 1) {
-                        for (int x = last_j + 1; x <= j; ++x) {
-                            kmer.ShiftAppend(cur_package.CharAt(i, x + globals.kmer_k - 1));
-                        }
-                        rev_kmer = kmer;
-                        rev_kmer.ReverseComplement();
-                    } else {
-                        for (int k = j - globals.step - 1; k < j + globals.kmer_k; ++k) {
-                            kmer.ShiftAppend(cur_package.CharAt(i, k));
-                        }
-                        rev_kmer = kmer;
-                        rev_kmer.ReverseComplement();
+            align_timer.stop();
+
+            // each partition is counted by one thread, so the same k-mer is never updated concurrently
+#pragma omp parallel for schedule(dynamic)
+            for (int p = 0; p < kNumEdgePartitions; ++p) {
+                for (int t = 0; t < num_threads; ++t) {
+                    vector<Kmer<kNumUint64> > &partition = edge_partitions[t * kNumEdgePartitions + p];
+                    for (size_t j = 0; j < partition.size(); ++j) {
+                        tables.iterative_edges.increment(partition[j], kMaxMulti_t);
                     }
-
-                    if (kmer < rev_kmer) {
-                        multi_t &multi = globals.iterative_edges.get_ref_with_lock(kmer);
-                        if (multi < kMaxMulti_t) { ++multi; }
-                        globals.iterative_edges.unlock(kmer);
-                    } else {
-                        multi_t &multi = globals.iterative_edges.get_ref_with_lock(rev_kmer);
-                        if (multi < kMaxMulti_t) { ++multi; }
-                        globals.iterative_edges.unlock(rev_kmer);
-                    }
-                    last_j = j;
-                    aligned = true;
+                    partition.clear();
                 }
             }
-            if (aligned) {
-                is_aligned.set(i);
-#pragma omp atomic
-                ++num_aligned_reads;
-            }
         }
 
         num_total_reads += cur_package.num_of_reads;
 
         for (int64_t i = 0; i < cur_package.num_of_reads; ++i) {
             if (is_aligned.get(i)) {
-                fwrite(cur_package.packed_reads + i * cur_package.words_per_read,
-                       sizeof(uint32_t), cur_package.words_per_read, globals.output_read_file);
+                if (globals.output_read_file != NULL) {
+                    fwrite(cur_package.packed_reads + i * cur_package.words_per_read,
+                           sizeof(uint32_t), cur_package.words_per_read, globals.output_read_file);
+                    AppendAlignedReadId(globals, num_stored_reads++);
+                } else {
+                    AppendAlignedReadId(globals, cur_read_ids[i]);
+                }
             }
         }
 
         if (num_total_reads % (16 * cur_package.kMaxNumReads) == 0) {
-            printf("Total: %lld, aligned: %lld. Iterative edges: %llu\n", (long long)num_total_reads, (long long)num_aligned_reads, (unsigned long long)globals.iterative_edges.size());
+            printf("Total: %lld, aligned: %lld. Iterative edges: %llu\n", (long long)num_total_reads, (long long)num_aligned_reads, (unsigned long long)tables.iterative_edges.size());
         }
     }
-    printf("Total: %lld, aligned: %lld. Iterative edges: %llu\n", (long long)num_total_reads, (long long)num_aligned_reads, (unsigned long long)globals.iterative_edges.size());
+    printf("Total: %lld, aligned: %lld. Iterative edges: %llu\n", (long long)num_total_reads, (long long)num_aligned_reads, (unsigned long long)tables.iterative_edges.size());
+    FlushAlignedReadIds(globals);
+    if (align_timer.elapsed() > 0) {
+        printf("Alignment: %.0lf reads/sec/thread\n", num_total_reads / align_timer.elapsed() / num_threads);
+    }
 
     printf("Writing iterative edges...\n");
+    // the edges are written in sorted order, in blocks packed in parallel
+    vector<size_t> edge_slots;
+    edge_slots.reserve(tables.iterative_edges.size());
+    for (size_t i = 0; i < tables.iterative_edges.capacity(); ++i) {
+        if (tables.iterative_edges.is_occupied(i)) {
+            edge_slots.push_back(i);
+        }
+    }
+    __gnu_parallel::sort(edge_slots.begin(), edge_slots.end(), CompareEdgeSlots<kNumUint64>(tables.iterative_edges));
+
     int next_k = globals.step + globals.kmer_k;
     int last_shift = (next_k + 1) % 16;
     last_shift = (last_shift == 0 ? 0 : 16 - last_shift) * 2;
-    for (auto iter = globals.iterative_edges.begin(); iter != globals.iterative_edges.end(); ++iter) {
-        memset(packed_edge, 0, sizeof(uint32_t) * kWordsPerEdge);
-        int w = 0;
-        int end_word = 0;
-        for (int j = 0; j < next_k + 1; ) {
-            w = (w << 2) | iter->first.get_base(next_k - j);
-            ++j;
-            if (j % 16 == 0) {
-                packed_edge[end_word] = w;
-                w = 0;
-                end_word++;
+    vector<uint32_t> packed_edges(kEdgesPerWrite * kWordsPerEdge);
+    for (size_t begin = 0; begin < edge_slots.size(); begin += kEdgesPerWrite) {
+        size_t end = std::min(edge_slots.size(), begin + kEdgesPerWrite);
+
+#pragma omp parallel for
+        for (size_t i = begin; i < end; ++i) {
+            const Kmer<kNumUint64> &kmer = tables.iterative_edges.key_at(edge_slots[i]);
+            uint32_t *packed_edge = &packed_edges[(i - begin) * kWordsPerEdge];
+            memset(packed_edge, 0, sizeof(uint32_t) * kWordsPerEdge);
+            int w = 0;
+            int end_word = 0;
+            for (int j = 0; j < next_k + 1; ) {
+                w = (w << 2) | kmer.get_base(next_k - j);
+                ++j;
+                if (j % 16 == 0) {
+                    packed_edge[end_word] = w;
+                    w = 0;
+                    end_word++;
+                }
+            }
+            packed_edge[end_word] = (w << last_shift);
+            assert((packed_edge[kWordsPerEdge - 1] & kMaxMulti_t) == 0);
+            packed_edge[kWordsPerEdge - 1] |= tables.iterative_edges.value_at(edge_slots[i]);
+        }
+
+        fwrite(packed_edges.data(), sizeof(uint32_t), (end - begin) * kWordsPerEdge, globals.output_edge_file);
+    }
+}
+
+template <uint32_t kNumUint64>
+static void Iterate(IterateGlobalData &globals) {
+    IterateKmerTables<kNumUint64> tables;
+
+    // the crusial k-mers only depend on the contigs, k and step; the contigs are still read for their edges
+    bool use_kmer_index = false;
+    uint64_t index_tag = 0;
+    globals.crusial_kmers_loaded = false;
+    if (options.kmer_index_file != "") {
+        if (ChecksumFile(options.contigs_file, index_tag)) {
+            use_kmer_index = true;
+            index_tag = HashMix(index_tag ^ (uint64_t(globals.kmer_k) << 32 | globals.step));
+            globals.crusial_kmers_loaded = tables.crusial_kmers.load(options.kmer_index_file.c_str(), index_tag);
+            if (globals.crusial_kmers_loaded) {
+                printf("Loaded %lu crusial kmers from %s\n", tables.crusial_kmers.size(), options.kmer_index_file.c_str());
             }
+        } else {
+            fprintf(stderr, "[WARNING] %s is not a regular file, the kmer index is not used\n", options.contigs_file.c_str());
         }
-        packed_edge[end_word] = (w << last_shift);
-        assert((packed_edge[kWordsPerEdge - 1] & kMaxMulti_t) == 0);
-        packed_edge[kWordsPerEdge - 1] |= iter->second;
-        fwrite(packed_edge, sizeof(uint32_t), kWordsPerEdge, globals.output_edge_file);
     }
-}
\ No newline at end of file
+
+    ReadContigsAndBuildHash(globals, tables, false);
+    if (options.addi_contig_file != "") {
+        ReadContigsAndBuildHash(globals, tables, true);
+    }
+    if (use_kmer_index && !globals.crusial_kmers_loaded) {
+        if (tables.crusial_kmers.save(options.kmer_index_file.c_str(), index_tag)) {
+            printf("Saved %lu crusial kmers to %s\n", tables.crusial_kmers.size(), options.kmer_index_file.c_str());
+        } else {
+            fprintf(stderr, "[WARNING] cannot save the kmer index to %s\n", options.kmer_index_file.c_str());
+        }
+    }
+    BuildCrusialFilter(tables);
+    ReadReadsAndProcess(globals, tables);
+}
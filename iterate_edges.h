@@ -27,8 +27,19 @@
 #include <zlib.h>
 #include "definitions.h"
 #include "kmer.h"
-#include "hash_set.h"
-#include "hash_map.h"
+#include "kmer_hash_map.h"
+#include "kmer_bloom_filter.h"
+
+static const uint32_t kMaxKmerNumUint64 = 5; // enough for (k+s+1)-mers with k up to SuccinctDBG::kMaxKmerK
+
+// large tables; the number of words of a k-mer is chosen at runtime by k+s+1
+template <uint32_t kNumUint64>
+struct IterateKmerTables {
+    KmerHashMap<kNumUint64, uint64_t> crusial_kmers; // assume that iterate step <= 29, s.t. 64 bit can store them
+                                                     // the last 6 bits store the length
+    KmerBloomFilter<kNumUint64> crusial_filter; // of the keys of crusial_kmers, to skip most of the missing lookups
+    KmerHashMap<kNumUint64, multi_t> iterative_edges;
+};
 
 struct IterateGlobalData {
     char dna_map[256];
@@ -38,8 +49,15 @@ struct IterateGlobalData {
     gzFile addi_contig_file;
     gzFile addi_multi_file;
     gzFile read_file;
+    gzFile read_ids_file; // runs of ids of the binary reads to be aligned; NULL for all reads
     FILE *output_edge_file;
-    FILE *output_read_file;
+    FILE *output_read_file; // aligned reads, only if the input reads are not binary
+    FILE *output_read_ids_file; // runs of ids of the aligned reads
+
+    int64_t read_run_start; // the run being read
+    int64_t read_run_length;
+    int64_t output_run_start; // the run being written
+    int64_t output_run_length;
 
     enum ReadFormats {
         kFasta,
@@ -51,11 +69,7 @@ struct IterateGlobalData {
     int step;
     int max_read_len;
     int num_cpu_threads;
-
-    // large table
-    HashMap<Kmer<KMER_NUM_UINT64>, uint64_t> crusial_kmers; // assume that iterate step <= 29, s.t. 64 bit can store them
-                                           // the last 6 bits store the length
-    HashMap<Kmer<KMER_NUM_UINT64>, multi_t> iterative_edges;
+    bool crusial_kmers_loaded; // from the kmer index, so the contigs only give the edges
 
     // stat
     int64_t num_of_reads;
@@ -34,6 +34,7 @@
 #include <cstring>
 
 #include "bit_operation.h"
+#include "hash.h"
 
 
 /**
@@ -101,7 +102,7 @@ public:
     const Kmer &ReverseComplement()
     {
         uint32_t kmer_size = size();
-        uint32_t used_words = (kmer_size + 31) >> 5;
+        uint32_t used_words = std::min((kmer_size + 31) >> 5, kNumUint64);
 
         resize(0);
 
@@ -128,7 +129,7 @@ public:
     {
         ch &= 3;
         uint32_t kmer_size = size();
-        uint32_t used_words = (kmer_size + 31) >> 5;
+        uint32_t used_words = std::min((kmer_size + 31) >> 5, kNumUint64);
 
         resize(0);
 
@@ -143,7 +144,7 @@ public:
     {
         ch &= 3;
         uint32_t kmer_size = size();
-        uint32_t used_words = (kmer_size + 31) >> 5;
+        uint32_t used_words = std::min((kmer_size + 31) >> 5, kNumUint64);
 
         resize(0);
 
@@ -164,12 +165,7 @@ public:
     }
 
     uint64_t hash() const
-    {
-        uint64_t key = 0;
-        for (unsigned i = 0; i < kNumUint64; ++i)
-            key ^= data_[i];
-        return (key * 1299709 + 104729) % 323780508946331ULL;
-    }
+    { return HashWords(data_, kNumUint64); }
 
     Kmer unique_format() const
     {
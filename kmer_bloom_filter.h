@@ -0,0 +1,76 @@
+/*
+ *  MEGAHIT
+ *  Copyright (C) 2014 The University of Hong Kong
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef KMER_BLOOM_FILTER_H_
+#define KMER_BLOOM_FILTER_H_
+
+#include <stdint.h>
+#include <vector>
+#include "kmer.h"
+
+/**
+ * @brief A blocked Bloom filter of Kmers: all bits of a key are in one 64-bit word,
+ * so a query reads a single word. insert() may be called by many threads at the same time.
+ */
+template <uint32_t kNumUint64>
+class KmerBloomFilter {
+public:
+    typedef Kmer<kNumUint64> key_type;
+
+    KmerBloomFilter(): mask_(0) {}
+
+    // not thread-safe; all keys are removed
+    void reset(size_t num_keys) {
+        size_t num_words = 1;
+        while (num_words * 64 < num_keys * kBitsPerKey) {
+            num_words <<= 1;
+        }
+        std::vector<uint64_t>(num_words, 0).swap(words_);
+        mask_ = num_words - 1;
+    }
+
+    void insert(const key_type &key) {
+        uint64_t h = key.hash();
+        __sync_fetch_and_or(&words_[h & mask_], Bits_(h));
+    }
+
+    // false if the key is definitely not inserted
+    bool may_contain(const key_type &key) const {
+        uint64_t h = key.hash();
+        uint64_t bits = Bits_(h);
+        return (words_[h & mask_] & bits) == bits;
+    }
+
+private:
+    static const size_t kBitsPerKey = 16;
+    static const int kNumHashes = 3;
+
+    // the bit positions are taken from the high bits, the word from the low bits
+    static uint64_t Bits_(uint64_t h) {
+        uint64_t bits = 0;
+        for (int i = 0; i < kNumHashes; ++i) {
+            bits |= uint64_t(1) << ((h >> (64 - 6 * (i + 1))) & 63);
+        }
+        return bits;
+    }
+
+    std::vector<uint64_t> words_;
+    uint64_t mask_;
+};
+
+#endif // KMER_BLOOM_FILTER_H_
@@ -0,0 +1,328 @@
+/*
+ *  MEGAHIT
+ *  Copyright (C) 2014 The University of Hong Kong
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef KMER_HASH_MAP_H_
+#define KMER_HASH_MAP_H_
+
+#include <assert.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <vector>
+#include "kmer.h"
+
+/**
+ * @brief A concurrent open-addressing hash map with Kmer keys and linear probing.
+ * set() and increment() may be called by many threads at the same time; the
+ * table grows cooperatively: when it is too full, the thread that notices it
+ * stops the writers and all threads that come in migrate chunks of the slots.
+ * find() and the slot accessors must not run concurrently with writers.
+ * The slots can be saved to a file and loaded back without rehashing.
+ */
+template <uint32_t kNumUint64, typename Value>
+class KmerHashMap {
+public:
+    typedef Kmer<kNumUint64> key_type;
+    typedef Value value_type;
+
+    KmerHashMap(): capacity_(0), max_size_(0), size_(0), num_active_(0), num_helpers_(0),
+        resizing_(0), migrating_(0), migrate_next_(0), migrate_done_(0), num_chunks_(0) {
+        reserve(0);
+    }
+
+    size_t size() const { return size_; }
+    size_t capacity() const { return capacity_; }
+
+    // slot accessors, for iterating over the entries
+    bool is_occupied(size_t i) const { return states_[i] == kReady; }
+    const key_type &key_at(size_t i) const { return keys_[i]; }
+    const value_type &value_at(size_t i) const { return values_[i]; }
+
+    // not thread-safe
+    void reserve(size_t num_entries) {
+        size_t capacity = kMinCapacity;
+        while (capacity * kMaxLoadNumerator / kMaxLoadDenominator < num_entries) {
+            capacity <<= 1;
+        }
+        if (capacity <= capacity_) { return; }
+
+        PrepareMigration_(capacity);
+        for (int64_t i = 0; i < num_chunks_; ++i) {
+            MigrateChunk_(i);
+        }
+        FinishMigration_();
+    }
+
+    // not thread-safe
+    void clear() {
+        std::vector<key_type>().swap(keys_);
+        std::vector<value_type>().swap(values_);
+        std::vector<uint8_t>().swap(states_);
+        capacity_ = max_size_ = size_ = 0;
+        reserve(0);
+    }
+
+    // the file is a header followed by the slot arrays, each written at once; tag identifies
+    // what the table was built from. Not thread-safe
+    bool save(const char *file_name, uint64_t tag) const {
+        FileHeader header = { kFileMagic, kNumUint64, sizeof(value_type), tag, capacity_, size_ };
+        FILE *file = fopen(file_name, "wb");
+        if (file == NULL) { return false; }
+        bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+            && fwrite(&keys_[0], sizeof(key_type), capacity_, file) == capacity_
+            && fwrite(&values_[0], sizeof(value_type), capacity_, file) == capacity_
+            && fwrite(&states_[0], sizeof(uint8_t), capacity_, file) == capacity_;
+        return fclose(file) == 0 && ok;
+    }
+
+    // replaces the content by the table saved in file_name, which is mapped and copied slot array
+    // by slot array; fails, leaving the table unchanged, if the file is missing, truncated, or
+    // saved with another tag or key/value type. Not thread-safe
+    bool load(const char *file_name, uint64_t tag) {
+        int fd = open(file_name, O_RDONLY);
+        if (fd == -1) { return false; }
+        struct stat file_stat;
+        bool ok = fstat(fd, &file_stat) == 0 && (size_t)file_stat.st_size >= sizeof(FileHeader);
+        void *image = ok ? mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+        close(fd);
+        if (image == MAP_FAILED) { return false; }
+        madvise(image, file_stat.st_size, MADV_SEQUENTIAL);
+
+        const FileHeader &header = *(const FileHeader *)image;
+        size_t capacity = header.capacity;
+        ok = header.magic == kFileMagic && header.num_words == kNumUint64 && header.value_size == sizeof(value_type)
+            && header.tag == tag && capacity >= kMinCapacity && (capacity & (capacity - 1)) == 0
+            && (size_t)file_stat.st_size == sizeof(FileHeader) + capacity * (sizeof(key_type) + sizeof(value_type) + 1);
+        if (ok) {
+            const key_type *keys = (const key_type *)((const char *)image + sizeof(FileHeader));
+            const value_type *values = (const value_type *)(keys + capacity);
+            const uint8_t *states = (const uint8_t *)(values + capacity);
+            keys_.assign(keys, keys + capacity);
+            values_.assign(values, values + capacity);
+            states_.assign(states, states + capacity);
+            capacity_ = capacity;
+            max_size_ = capacity_ * kMaxLoadNumerator / kMaxLoadDenominator;
+            size_ = header.size;
+        }
+        munmap(image, file_stat.st_size);
+        return ok;
+    }
+
+    value_type *find(const key_type &key) {
+        for (size_t i = key.hash() & (capacity_ - 1); ; i = (i + 1) & (capacity_ - 1)) {
+            if (states_[i] == kEmpty) { return NULL; }
+            if (keys_[i] == key) { return &values_[i]; }
+        }
+    }
+
+    // hint the cache about the first slot that find(key) will read
+    void prefetch(const key_type &key) const {
+        size_t i = key.hash() & (capacity_ - 1);
+        __builtin_prefetch(&states_[i]);
+        __builtin_prefetch(&keys_[i]);
+    }
+
+    void set(const key_type &key, const value_type &value) {
+        Enter_();
+        bool inserted;
+        value_type *p = FindOrInsert_(key, value, inserted);
+        if (!inserted) { *p = value; }
+        Leave_(inserted);
+    }
+
+    // increase the value of key by one, but not beyond max_value; absent keys are inserted with value 1
+    void increment(const key_type &key, value_type max_value) {
+        Enter_();
+        bool inserted;
+        value_type *p = FindOrInsert_(key, 1, inserted);
+        if (!inserted) {
+            value_type old_value;
+            do {
+                old_value = *p;
+            } while (old_value < max_value && !__sync_bool_compare_and_swap(p, old_value, old_value + 1));
+        }
+        Leave_(inserted);
+    }
+
+private:
+    static const size_t kMinCapacity = 1 << 10;
+    static const size_t kMaxLoadNumerator = 7;
+    static const size_t kMaxLoadDenominator = 10;
+    static const size_t kSlotsPerChunk = 1 << 14;
+    static const uint64_t kFileMagic = 0x5041484d52454d4bULL; // "KMERMHAP"
+
+    struct FileHeader {
+        uint64_t magic;
+        uint64_t num_words;
+        uint64_t value_size;
+        uint64_t tag;
+        uint64_t capacity;
+        uint64_t size;
+    };
+
+    enum SlotState {
+        kEmpty = 0,
+        kBusy = 1, // claimed, the key is being written
+        kReady = 2,
+    };
+
+    // a writer is counted in num_active_; it backs off and helps if a resize is going on
+    void Enter_() {
+        while (true) {
+            if (resizing_) {
+                HelpMigration_();
+                continue;
+            }
+            __sync_fetch_and_add(&num_active_, 1);
+            if (!resizing_) { break; }
+            __sync_fetch_and_sub(&num_active_, 1);
+        }
+    }
+
+    void Leave_(bool inserted) {
+        __sync_fetch_and_sub(&num_active_, 1);
+        if (inserted && __sync_add_and_fetch(&size_, 1) > max_size_) {
+            Grow_();
+        }
+    }
+
+    value_type *FindOrInsert_(const key_type &key, const value_type &init_value, bool &inserted) {
+        for (size_t i = key.hash() & (capacity_ - 1); ; i = (i + 1) & (capacity_ - 1)) {
+            uint8_t state = __atomic_load_n(&states_[i], __ATOMIC_ACQUIRE);
+            if (state == kEmpty && __sync_bool_compare_and_swap(&states_[i], kEmpty, kBusy)) {
+                keys_[i] = key;
+                values_[i] = init_value;
+                __atomic_store_n(&states_[i], kReady, __ATOMIC_RELEASE);
+                inserted = true;
+                return &values_[i];
+            }
+            while ((state = __atomic_load_n(&states_[i], __ATOMIC_ACQUIRE)) == kBusy) {}
+            if (state == kReady && keys_[i] == key) {
+                inserted = false;
+                return &values_[i];
+            }
+        }
+    }
+
+    void Grow_() {
+        if (!__sync_bool_compare_and_swap(&resizing_, 0, 1)) { return; }
+        while (num_active_ > 0 || num_helpers_ > 0) { sched_yield(); }
+        if (size_ <= max_size_) {
+            resizing_ = 0;
+            return;
+        }
+
+        PrepareMigration_(capacity_ * 2);
+        __sync_synchronize();
+        migrating_ = 1;
+        MigrateChunks_();
+        while (migrate_done_ < num_chunks_) { sched_yield(); }
+
+        migrating_ = 0;
+        __sync_synchronize();
+        while (num_helpers_ > 0) { sched_yield(); }
+        FinishMigration_();
+        __sync_synchronize();
+        resizing_ = 0;
+    }
+
+    void HelpMigration_() {
+        while (resizing_) {
+            if (migrating_) {
+                __sync_fetch_and_add(&num_helpers_, 1);
+                if (migrating_) { MigrateChunks_(); }
+                __sync_fetch_and_sub(&num_helpers_, 1);
+                while (migrating_) { sched_yield(); }
+            } else {
+                sched_yield();
+            }
+        }
+    }
+
+    void MigrateChunks_() {
+        int64_t chunk_id;
+        while ((chunk_id = __sync_fetch_and_add(&migrate_next_, 1)) < num_chunks_) {
+            MigrateChunk_(chunk_id);
+            __sync_fetch_and_add(&migrate_done_, 1);
+        }
+    }
+
+    void PrepareMigration_(size_t new_capacity) {
+        new_keys_.resize(new_capacity);
+        new_values_.resize(new_capacity);
+        new_states_.resize(new_capacity, kEmpty);
+        new_capacity_ = new_capacity;
+        num_chunks_ = (capacity_ + kSlotsPerChunk - 1) / kSlotsPerChunk;
+        migrate_next_ = 0;
+        migrate_done_ = 0;
+    }
+
+    void MigrateChunk_(int64_t chunk_id) {
+        size_t end = std::min(capacity_, (chunk_id + 1) * kSlotsPerChunk);
+        for (size_t i = chunk_id * kSlotsPerChunk; i < end; ++i) {
+            if (states_[i] != kReady) { continue; }
+            size_t j = keys_[i].hash() & (new_capacity_ - 1);
+            while (!__sync_bool_compare_and_swap(&new_states_[j], kEmpty, kReady)) {
+                j = (j + 1) & (new_capacity_ - 1);
+            }
+            new_keys_[j] = keys_[i];
+            new_values_[j] = values_[i];
+        }
+    }
+
+    void FinishMigration_() {
+        keys_.swap(new_keys_);
+        values_.swap(new_values_);
+        states_.swap(new_states_);
+        std::vector<key_type>().swap(new_keys_);
+        std::vector<value_type>().swap(new_values_);
+        std::vector<uint8_t>().swap(new_states_);
+        capacity_ = new_capacity_;
+        max_size_ = capacity_ * kMaxLoadNumerator / kMaxLoadDenominator;
+    }
+
+    std::vector<key_type> keys_;
+    std::vector<value_type> values_;
+    std::vector<uint8_t> states_;
+    size_t capacity_; // always a power of 2
+    size_t max_size_;
+    volatile size_t size_;
+
+    // for resizing
+    volatile int64_t num_active_;
+    volatile int64_t num_helpers_;
+    volatile int resizing_;
+    volatile int migrating_;
+    volatile int64_t migrate_next_;
+    volatile int64_t migrate_done_;
+    int64_t num_chunks_;
+    std::vector<key_type> new_keys_;
+    std::vector<value_type> new_values_;
+    std::vector<uint8_t> new_states_;
+    size_t new_capacity_;
+
+    KmerHashMap(const KmerHashMap &);
+    const KmerHashMap &operator =(const KmerHashMap &);
+};
+
+#endif // KMER_HASH_MAP_H_
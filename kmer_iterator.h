@@ -0,0 +1,83 @@
+/*
+ *  MEGAHIT
+ *  Copyright (C) 2014 The University of Hong Kong
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef KMER_ITERATOR_H_
+#define KMER_ITERATOR_H_
+
+#include <stdint.h>
+#include <assert.h>
+#include "kmer.h"
+
+/**
+ * @brief Rolls a k-mer and its reverse complement along a sequence, one base at a time.
+ * k is fixed at construction, so the size bits of the last word and the masks are computed
+ * once, and a step only shifts the words that hold the k-mer.
+ */
+template <uint32_t kNumUint64>
+class KmerIterator {
+public:
+    typedef Kmer<kNumUint64> kmer_type;
+
+    explicit KmerIterator(uint32_t k):
+        forward_(k), reverse_(k),
+        last_word_((k + 31) / 32 - 1),
+        top_shift_(((k - 1) & 31) * 2),
+        top_mask_((k & 31) == 0 ? ~0ULL : (1ULL << ((k & 31) * 2)) - 1),
+        size_bits_(last_word_ == kNumUint64 - 1 ? forward_.data_[kNumUint64 - 1] : 0) {
+        assert(k > 0 && k <= kmer_type::max_size());
+    }
+
+    uint32_t k() const { return forward_.size(); }
+
+    // appends ch to the forward k-mer and prepends its complement to the reverse complement
+    void push_back(uint8_t ch) {
+        ch &= 3;
+        uint64_t *fw = forward_.data_;
+        for (unsigned i = 0; i < last_word_; ++i) {
+            fw[i] = (fw[i] >> 2) | (fw[i + 1] << 62);
+        }
+        fw[last_word_] = ((fw[last_word_] & ~size_bits_) >> 2) | (uint64_t(ch) << top_shift_) | size_bits_;
+
+        uint64_t *rc = reverse_.data_;
+        for (unsigned i = last_word_; i > 0; --i) {
+            rc[i] = (rc[i] << 2) | (rc[i - 1] >> 62);
+        }
+        rc[0] = (rc[0] << 2) | (3 - ch);
+        rc[last_word_] = (rc[last_word_] & top_mask_) | size_bits_;
+    }
+
+    const kmer_type &forward() const { return forward_; }
+    const kmer_type &reverse_complement() const { return reverse_; }
+
+    bool is_forward_canonical() const { return !(reverse_ < forward_); }
+    const kmer_type &canonical() const { return is_forward_canonical() ? forward_ : reverse_; }
+
+    // the hash of the canonical k-mer, equal to canonical().hash(), so that it can be
+    // used with the tables keyed by Kmer
+    uint64_t canonical_hash() const { return canonical().hash(); }
+
+private:
+    kmer_type forward_;
+    kmer_type reverse_;
+    unsigned last_word_;  // index of the highest word holding bases
+    unsigned top_shift_;  // bit offset of base k-1 in that word
+    uint64_t top_mask_;   // the bits of the bases in that word
+    uint64_t size_bits_;  // the size field if it shares that word, else 0
+};
+
+#endif // KMER_ITERATOR_H_
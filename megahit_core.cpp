@@ -0,0 +1,59 @@
+/*
+ *  MEGAHIT
+ *  Copyright (C) 2014 The University of Hong Kong
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "megahit_core.h"
+
+struct Stage {
+    const char *name;
+    int (*entry)(int argc, char **argv);
+    const char *description;
+};
+
+static const Stage kStages[] = {
+    {"sdbg_builder", main_sdbg_builder, "count solid edges (count) or build the succinct de Bruijn graph (build)"},
+    {"assembler", main_assembler, "assemble contigs from the succinct de Bruijn graph"},
+    {"iterate_edges", main_iterate_edges, "extract the edges of the next k from contigs and reads"},
+};
+
+static void DisplayHelp(const char *program_name) {
+    fprintf(stderr, "Usage: %s <stage> [stage options]\n", program_name);
+    fprintf(stderr, "stages:\n");
+    for (unsigned i = 0; i < sizeof(kStages) / sizeof(kStages[0]); ++i) {
+        fprintf(stderr, "    %-16s%s\n", kStages[i].name, kStages[i].description);
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        DisplayHelp(argv[0]);
+        return 1;
+    }
+
+    for (unsigned i = 0; i < sizeof(kStages) / sizeof(kStages[0]); ++i) {
+        if (strcmp(argv[1], kStages[i].name) == 0) {
+            // the stage sees its name as argv[0]
+            return kStages[i].entry(argc - 1, argv + 1);
+        }
+    }
+
+    fprintf(stderr, "Unknown stage: %s\n", argv[1]);
+    DisplayHelp(argv[0]);
+    return 1;
+}
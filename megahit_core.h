@@ -0,0 +1,27 @@
+/*
+ *  MEGAHIT
+ *  Copyright (C) 2014 The University of Hong Kong
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MEGAHIT_CORE_H_
+#define MEGAHIT_CORE_H_
+
+// entries of the stages linked into megahit_core; each takes the command line of the stage
+int main_sdbg_builder(int argc, char **argv);
+int main_assembler(int argc, char **argv);
+int main_iterate_edges(int argc, char **argv);
+
+#endif // MEGAHIT_CORE_H_
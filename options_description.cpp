@@ -78,6 +78,7 @@ void OptionsDescription::Parse(int &argc, char *argv[])
     long_options[options.size()].flag = 0;
     long_options[options.size()].val = 0;
 
+    optind = 0; // rescan from the start, as Parse() may be called more than once in a process
     while (true)
     {
         int index = -1;
@@ -28,8 +28,9 @@
 #include "lv2_gpu_functions.h"
 #include "helper_functions-inl.h"
 #include "sdbg_builder_util.h"
+#include "megahit_core.h"
 
-struct Phase1Options {
+static struct Phase1Options {
     int kmer_k;
     int min_edge_freq;
     double host_mem;
@@ -53,7 +54,7 @@ struct Phase1Options {
     }
 } phase1_options;
 
-struct Phase2Options {
+static struct Phase2Options {
     bool need_mercy;
     double host_mem;
     double gpu_mem;
@@ -78,7 +79,7 @@ struct Phase2Options {
     }
 } phase2_options;
 
-void ParsePhase1Option(int argc, char *argv[]) {
+static void ParsePhase1Option(int argc, char *argv[]) {
     OptionsDescription desc;
 
     desc.AddOption("kmer_k", "k", phase1_options.kmer_k, "kmer size");
@@ -138,7 +139,7 @@ void ParsePhase1Option(int argc, char *argv[]) {
     }
 }
 
-void ParsePhase2Option(int argc, char *argv[]) {
+static void ParsePhase2Option(int argc, char *argv[]) {
     OptionsDescription desc;
 
     desc.AddOption("host_mem", "", phase2_options.host_mem, "memory to be used. No more than 95% of the free memory is recommended. 0 for auto detect.");
@@ -201,7 +202,7 @@ void ParsePhase2Option(int argc, char *argv[]) {
     }
 }
 
-void DisplayHelp(char *program_name) {
+static void DisplayHelp(char *program_name) {
     fprintf(stderr, "Usage: \n");
     fprintf(stderr, "    1. Counting & output solid edges: \n");
     fprintf(stderr, "       type \"%s count\" for help.\n", program_name);
@@ -209,7 +210,7 @@ void DisplayHelp(char *program_name) {
     fprintf(stderr, "       type \"%s build\" for help.\n", program_name);
 }
 
-int main(int argc, char** argv) {
+int main_sdbg_builder(int argc, char** argv) {
     struct global_data_t globals;
 
     if (argc < 2 || 
@@ -219,6 +220,7 @@ int main(int argc, char** argv) {
     }
 
     if (std::string(argv[1]) == "count") {
+        phase1_options = Phase1Options();
         ParsePhase1Option(argc - 1, argv + 1);
 
         globals.kmer_k = phase1_options.kmer_k;
@@ -243,6 +245,7 @@ int main(int argc, char** argv) {
 
         phase1::Phase1Entry(globals);
     } else if (std::string(argv[1]) == "build") {
+        phase2_options = Phase2Options();
         ParsePhase2Option(argc - 1, argv + 1);
 
         globals.need_mercy = phase2_options.need_mercy;
@@ -269,3 +272,9 @@ int main(int argc, char** argv) {
 
     return 0;
 }
+
+#ifndef MEGAHIT_CORE
+int main(int argc, char** argv) {
+    return main_sdbg_builder(argc, argv);
+}
+#endif
@@ -21,7 +21,10 @@
 #include "unitig_graph.h"
 
 #include <omp.h>
+#include <stdio.h>
+#include <map>
 #include <queue>
+#include <string>
 #include <set>
 #include <vector>
 #include <algorithm>
@@ -64,13 +67,86 @@ static inline void ReverseComplement(std::string &s) {
     if (i == j) { s[i] = Complement(s[i]); }
 }
 
+// Contigs are formatted into per-thread buffers and flushed in vertex order, so that
+// contig ids and the order of output do not depend on thread scheduling.
+class OrderedContigWriter {
+  public:
+    static const uint32_t kBatchSize = 1 << 16; // number of vertices formatted between two flushes
+
+    OrderedContigWriter(const std::string &id_prefix, FILE *contig_file, FILE *multi_file, FILE *final_contig_file = NULL):
+        id_prefix_(id_prefix), contig_file_(contig_file), multi_file_(multi_file), final_contig_file_(final_contig_file),
+        buffers_(omp_get_max_threads()), output_id_(0) {}
+
+    void Append(const char *header, const std::string &label, uint16_t multi, bool is_final = false) {
+        ThreadBuffer &buffer = buffers_[omp_get_thread_num()];
+        buffer.text += header;
+        buffer.text += '\n';
+        buffer.text += label;
+        buffer.text += '\n';
+        buffer.record_ends.push_back(buffer.text.length());
+        buffer.multis.push_back(multi);
+        buffer.is_final.push_back(is_final);
+    }
+
+    std::map<int64_t, int> &histo() { return buffers_[omp_get_thread_num()].histo; }
+
+    // must be called outside parallel regions; the buffers are written in thread order,
+    // which is the vertex order under the static schedule
+    void Flush() {
+        for (unsigned t = 0; t < buffers_.size(); ++t) {
+            ThreadBuffer &buffer = buffers_[t];
+            size_t begin = 0;
+            for (unsigned j = 0; j < buffer.record_ends.size(); ++j) {
+                FILE *out_file = buffer.is_final[j] ? final_contig_file_ : contig_file_;
+                fprintf(out_file, "%s%u", id_prefix_.c_str(), output_id_++);
+                fwrite(buffer.text.data() + begin, 1, buffer.record_ends[j] - begin, out_file);
+                if (!buffer.is_final[j] && multi_file_ != NULL) {
+                    fwrite(&buffer.multis[j], sizeof(uint16_t), 1, multi_file_);
+                }
+                begin = buffer.record_ends[j];
+            }
+            buffer.text.clear();
+            buffer.record_ends.clear();
+            buffer.multis.clear();
+            buffer.is_final.clear();
+        }
+    }
+
+    void MergeHisto(std::map<int64_t, int> &histo) {
+        for (unsigned t = 0; t < buffers_.size(); ++t) {
+            for (std::map<int64_t, int>::iterator it = buffers_[t].histo.begin(); it != buffers_[t].histo.end(); ++it) {
+                histo[it->first] += it->second;
+            }
+            buffers_[t].histo.clear();
+        }
+    }
+
+  private:
+    struct ThreadBuffer {
+        std::string text; // records without the contig id prefix
+        std::vector<size_t> record_ends;
+        std::vector<uint16_t> multis;
+        std::vector<bool> is_final;
+        std::map<int64_t, int> histo;
+    };
+
+    std::string id_prefix_;
+    FILE *contig_file_;
+    FILE *multi_file_;
+    FILE *final_contig_file_;
+    std::vector<ThreadBuffer> buffers_;
+    uint32_t output_id_;
+};
+
 void UnitigGraph::InitFromSdBG() {
-    start_node_map_.clear();
     vertices_.clear();
+    label_arena_.clear();
 
-    omp_lock_t path_lock;
-    omp_init_lock(&path_lock);
     AtomicBitVector marked(sdbg_->size);
+    int num_threads = omp_get_max_threads();
+    // vertices are assembled to per-thread buffers, their label offsets are local to the thread's arena
+    std::vector<std::vector<UnitigGraphVertex> > thread_vertices(num_threads);
+    std::vector<std::vector<uint64_t> > thread_labels(num_threads);
 
     // assemble simple paths
 #pragma omp parallel for
@@ -142,66 +218,152 @@ void UnitigGraph::InitFromSdBG() {
             }
             unitig.Reverse();
 
-            omp_set_lock(&path_lock);
-            vertices_.push_back(UnitigGraphVertex(cur_node, node_idx, rc_start, rc_end, depth, unitig));
-            omp_unset_lock(&path_lock);
+            int thread_id = omp_get_thread_num();
+            thread_vertices[thread_id].push_back(UnitigGraphVertex(cur_node, node_idx, rc_start, rc_end, depth, 
+                                                                   AppendLabel_(thread_labels[thread_id], unitig), unitig.length()));
         } // end if
     } // end for
 
-    // assemble looped paths
+    // assemble looped paths: the remaining nodes form cycles. Each thread locks a segment of a cycle by walking
+    // backward from an unlocked node, until it comes back, or reaches the first node of another segment.
+    std::vector<std::vector<std::pair<int64_t, int64_t> > > thread_segments(num_threads); // first: first node, second: the next segment, -1 if none
 #pragma omp parallel for
     for (int64_t node_idx = 0; node_idx < sdbg_->size; ++node_idx) {
-        if (!marked.get(node_idx) && sdbg_->IsValidNode(node_idx) && sdbg_->IsLast(node_idx)) {
-            omp_set_lock(&path_lock);
-            if (!marked.get(node_idx)) {
-                std::string unitig;
-                int64_t cur_node = node_idx;
-                int64_t depth = sdbg_->NodeMultiplicity(node_idx);
-                uint32_t length = 1;
-
-                bool rc_marked = marked.get(sdbg_->ReverseComplement(node_idx)); // whether it is marked before entering the loop
-
-                while (!marked.get(cur_node)) {
-                    marked.set(cur_node);
-                    int64_t prev_node = assembly_algorithms::PrevSimplePathNode(*sdbg_, cur_node);
-                    assert(prev_node != -1);
-                    cur_node = sdbg_->GetLastIndex(prev_node);
-                    depth += sdbg_->NodeMultiplicity(cur_node);
-                    int8_t cur_char = sdbg_->GetW(prev_node);
-                    unitig.push_back(cur_char > 4 ? (cur_char - 5) : (cur_char - 1));
-                    ++length;
+        if (sdbg_->IsValidNode(node_idx) && sdbg_->IsLast(node_idx) && marked.lock(node_idx)) {
+            int64_t cur_node = node_idx;
+            int64_t next_segment = -1;
+            while (true) {
+                int64_t prev_node = assembly_algorithms::PrevSimplePathNode(*sdbg_, cur_node);
+                assert(prev_node != -1);
+                cur_node = sdbg_->GetLastIndex(prev_node);
+                if (cur_node == node_idx) { break; }
+                if (!marked.lock(cur_node)) {
+                    next_segment = cur_node;
+                    break;
                 }
+            }
+            thread_segments[omp_get_thread_num()].push_back(std::make_pair(node_idx, next_segment));
+        }
+    }
 
-                if (!rc_marked) {
-                    uint8_t seq[sdbg_->kMaxKmerK];
-                    sdbg_->Label(cur_node, seq);
-                    for (int i = sdbg_->kmer_k - 1; i > 0; --i) {
-                        assert(seq[i] >= 1 && seq[i] <= 4);
-                        unitig.push_back(seq[i] - 1);
-                    }
-                    std::reverse(unitig.begin(), unitig.end());
-
-                    if (marked.get(sdbg_->ReverseComplement(node_idx))) {
-                        // this loop is palindrome
-                        assert(unitig.length() % 2 == 0);
-                        for (unsigned i = 1; i + sdbg_->kmer_k <= unitig.length(); ++i) {
-                            string rc = unitig.substr(i, sdbg_->kmer_k);
-                            ReverseComplement(rc);
-                            if (rc == unitig.substr(i - 1, sdbg_->kmer_k)) {
-                                assert(i <= unitig.length() / 2);
-                                unitig = unitig.substr(i, unitig.length() / 2);
-                                break;
-                            }
-                        }
-                    }
+    // each cycle is assembled from one of its segments
+    std::vector<int64_t> cycles;
+    {
+        std::vector<std::pair<int64_t, int64_t> > segments;
+        for (int t = 0; t < num_threads; ++t) {
+            for (unsigned j = 0; j < thread_segments[t].size(); ++j) {
+                if (thread_segments[t][j].second == -1) {
+                    cycles.push_back(thread_segments[t][j].first);
+                } else {
+                    segments.push_back(thread_segments[t][j]);
+                }
+            }
+        }
+        std::sort(segments.begin(), segments.end());
+
+        std::vector<bool> visited(segments.size(), false);
+        for (unsigned j = 0; j < segments.size(); ++j) {
+            if (visited[j]) { continue; }
+            cycles.push_back(segments[j].first);
+            for (unsigned x = j; !visited[x]; ) {
+                visited[x] = true;
+                unsigned next = std::lower_bound(segments.begin(), segments.end(), 
+                                                 std::make_pair(segments[x].second, int64_t(-1))) - segments.begin();
+                assert(next < segments.size() && segments[next].first == segments[x].second);
+                x = next;
+            }
+        }
+    }
+
+#pragma omp parallel for
+    for (unsigned j = 0; j < cycles.size(); ++j) {
+        int64_t node_idx = cycles[j];
+        std::string unitig;
+        int64_t cur_node = node_idx;
+        int64_t depth = sdbg_->NodeMultiplicity(node_idx);
+        uint32_t length = 1;
+        int64_t min_node = node_idx;
+
+        do {
+            int64_t prev_node = assembly_algorithms::PrevSimplePathNode(*sdbg_, cur_node);
+            assert(prev_node != -1);
+            cur_node = sdbg_->GetLastIndex(prev_node);
+            depth += sdbg_->NodeMultiplicity(cur_node);
+            int8_t cur_char = sdbg_->GetW(prev_node);
+            unitig.push_back(cur_char > 4 ? (cur_char - 5) : (cur_char - 1));
+            ++length;
+            min_node = std::min(min_node, cur_node);
+        } while (cur_node != node_idx);
+
+        // a cycle and its reverse complement are assembled once, by the one containing the smaller node
+        int64_t rc_node = sdbg_->ReverseComplement(node_idx);
+        int64_t rc_min_node = rc_node;
+        for (int64_t rc_cur_node = rc_node; ; ) {
+            int64_t prev_node = assembly_algorithms::PrevSimplePathNode(*sdbg_, rc_cur_node);
+            assert(prev_node != -1);
+            rc_cur_node = sdbg_->GetLastIndex(prev_node);
+            if (rc_cur_node == rc_node) { break; }
+            rc_min_node = std::min(rc_min_node, rc_cur_node);
+        }
+
+        if (rc_min_node < min_node) { continue; }
 
-                    vertices_.push_back(UnitigGraphVertex(cur_node, node_idx, 0, 0, int(depth * 1.0 / length + 0.5), CompactSequence(unitig)));
-                    vertices_.back().is_loop = true;
-                    vertices_.back().is_deleted = true;
+        uint8_t seq[sdbg_->kMaxKmerK];
+        sdbg_->Label(cur_node, seq);
+        for (int i = sdbg_->kmer_k - 1; i > 0; --i) {
+            assert(seq[i] >= 1 && seq[i] <= 4);
+            unitig.push_back(seq[i] - 1);
+        }
+        std::reverse(unitig.begin(), unitig.end());
+
+        if (rc_min_node == min_node) {
+            // this loop is palindrome
+            assert(unitig.length() % 2 == 0);
+            for (unsigned i = 1; i + sdbg_->kmer_k <= unitig.length(); ++i) {
+                string rc = unitig.substr(i, sdbg_->kmer_k);
+                ReverseComplement(rc);
+                if (rc == unitig.substr(i - 1, sdbg_->kmer_k)) {
+                    assert(i <= unitig.length() / 2);
+                    unitig = unitig.substr(i, unitig.length() / 2);
+                    break;
                 }
             }
-            omp_unset_lock(&path_lock);
         }
+
+        CompactSequence label(unitig);
+        int thread_id = omp_get_thread_num();
+        thread_vertices[thread_id].push_back(UnitigGraphVertex(cur_node, node_idx, 0, 0, int(depth * 1.0 / length + 0.5), 
+                                                               AppendLabel_(thread_labels[thread_id], label), label.length()));
+        thread_vertices[thread_id].back().is_loop = true;
+        thread_vertices[thread_id].back().is_deleted = true;
+    }
+
+    // merge the buffers of the threads
+    size_t num_vertices = 0;
+    size_t num_label_words = 0;
+    std::vector<size_t> label_word_offsets(num_threads);
+    for (int t = 0; t < num_threads; ++t) {
+        label_word_offsets[t] = num_label_words;
+        num_vertices += thread_vertices[t].size();
+        num_label_words += thread_labels[t].size();
+    }
+
+    vertices_.reserve(num_vertices);
+    label_arena_.resize(num_label_words);
+    for (int t = 0; t < num_threads; ++t) {
+        size_t vertex_offset = vertices_.size();
+        vertices_.insert(vertices_.end(), thread_vertices[t].begin(), thread_vertices[t].end());
+        std::vector<UnitigGraphVertex>().swap(thread_vertices[t]);
+#pragma omp parallel for
+        for (size_t i = vertex_offset; i < vertices_.size(); ++i) {
+            vertices_[i].label_offset += label_word_offsets[t] * kBasesPerLabelWord;
+        }
+    }
+
+#pragma omp parallel for
+    for (int t = 0; t < num_threads; ++t) {
+        std::copy(thread_labels[t].begin(), thread_labels[t].end(), label_arena_.begin() + label_word_offsets[t]);
+        std::vector<uint64_t>().swap(thread_labels[t]);
     }
 
     if (vertices_.size() >= kMaxNumVertices) {
@@ -217,68 +379,321 @@ void UnitigGraph::InitFromSdBG() {
     // }
     // printf("total_depth: %ld, total num: %u\n", total_depth, (unsigned)vertices_.size());
 
-    // free memory for hash table construction
+    // free memory for the start node index
     sdbg_->FreeMul();
     {
         AtomicBitVector empty_abv;
         marked.swap(empty_abv);
     }
 
-    start_node_map_.reserve(vertices_.size() * 2);
+    // start nodes of the vertices never change afterwards, only their owners do
+    is_start_node_.reset(sdbg_->size);
+#pragma omp parallel for
+    for (uint32_t i = 0; i < vertices_.size(); ++i) {
+        if (!vertices_[i].is_deleted) {
+            is_start_node_.set(vertices_[i].start_node);
+            is_start_node_.set(vertices_[i].rev_start_node);
+        }
+    }
+
+    start_node_rank_.Build(is_start_node_.data(), sdbg_->size);
+    start_node_vertex_.resize(start_node_rank_.total_num_ones);
+
+#pragma omp parallel for
+    for (uint32_t i = 0; i < vertices_.size(); ++i) {
+        if (!vertices_[i].is_deleted) {
+            SetStartNodeVertex_(vertices_[i].start_node, i);
+            SetStartNodeVertex_(vertices_[i].rev_start_node, i);
+        }
+    }
+
+    // adjacency in CSR, the successors of the end node of a vertex are listed under its rev_start_node,
+    // and those of the rev_end_node under its start_node
+    adj_offsets_.assign(start_node_vertex_.size() + 1, 0);
+#pragma omp parallel for
+    for (uint32_t i = 0; i < vertices_.size(); ++i) {
+        if (!vertices_[i].is_deleted) {
+            adj_offsets_[StartNodeIndex_(vertices_[i].rev_start_node) + 1] = sdbg_->Outdegree(vertices_[i].end_node);
+            adj_offsets_[StartNodeIndex_(vertices_[i].start_node) + 1] = sdbg_->Outdegree(vertices_[i].rev_end_node);
+        }
+    }
+
+    for (size_t i = 1; i < adj_offsets_.size(); ++i) {
+        adj_offsets_[i] += adj_offsets_[i - 1];
+    }
+    adj_nodes_.resize(adj_offsets_.back());
 
 #pragma omp parallel for
     for (uint32_t i = 0; i < vertices_.size(); ++i) {
         if (!vertices_[i].is_deleted) {
-            start_node_map_[vertices_[i].start_node] = i;
-            start_node_map_[vertices_[i].rev_start_node] = i;        
+            sdbg_->Outgoings(vertices_[i].end_node, adj_nodes_.data() + adj_offsets_[StartNodeIndex_(vertices_[i].rev_start_node)]);
+            sdbg_->Outgoings(vertices_[i].rev_end_node, adj_nodes_.data() + adj_offsets_[StartNodeIndex_(vertices_[i].start_node)]);
         }
     }
 
-    omp_destroy_lock(&path_lock);
 }
 
-bool UnitigGraph::RemoveLocalLowDepth(int min_depth, int min_len, int local_width, double local_ratio, int64_t &num_removed) {
-    bool is_changed = false;
-    bool need_refresh = false;
+int64_t UnitigGraph::RemoveLocalLowDepth(double min_depth, double max_depth, int min_len, int local_width, double local_ratio) {
+    // candidates are keyed by their depth, a vertex is removed once the threshold exceeds its depth
+    typedef std::pair<double, uint32_t> Candidate;
+    std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate> > candidates;
+    int64_t num_removed = 0;
 
+    {
+        omp_lock_t candidates_lock;
+        omp_init_lock(&candidates_lock);
 #pragma omp parallel for schedule(static, 1)
-    for (uint32_t i = 0; i < vertices_.size(); ++i) {
-        int vertex_length = vertices_[i].label.length() - sdbg_->kmer_k + 1;
-        if (vertices_[i].is_deleted || vertex_length >= min_len) { continue; }
-        assert(vertex_length > 0);
+        for (uint32_t i = 0; i < vertices_.size(); ++i) {
+            double depth = RemovalDepth_(i, min_len, local_width, local_ratio);
+            if (depth >= 0) {
+                omp_set_lock(&candidates_lock);
+                candidates.push(Candidate(depth, i));
+                omp_unset_lock(&candidates_lock);
+            }
+        }
+        omp_destroy_lock(&candidates_lock);
+    }
+
+    std::vector<uint32_t> removed;
+    std::vector<uint32_t> affected;
+    std::vector<uint32_t> merged;
 
-        int indegree = sdbg_->Indegree(vertices_[i].start_node);
-        int outdegree = sdbg_->Outdegree(vertices_[i].end_node);
+    while (!candidates.empty() && min_depth < max_depth) {
+        int threshold = min_depth;
+        removed.clear();
 
-        if (indegree + outdegree == 0) { continue; }
+        while (!candidates.empty() && candidates.top().first < threshold) {
+            uint32_t i = candidates.top().second;
+            candidates.pop();
+            if (vertices_[i].is_dead || vertices_[i].is_deleted) { continue; }
 
-        if ((indegree <= 1 && outdegree <= 1) || indegree == 0 || outdegree == 0) {
-            double depth = (double)vertices_[i].depth / vertex_length;
-            if (is_changed && depth > min_depth)
+            // the neighbourhood may be changed after it was pushed
+            double depth = RemovalDepth_(i, min_len, local_width, local_ratio);
+            if (depth < 0) { continue; }
+            if (depth >= threshold) {
+                candidates.push(Candidate(depth, i));
                 continue;
-            
-            double mean = LocalDepth_(vertices_[i], local_width);
-            double threshold = min_depth;
-            if (min_depth < mean * local_ratio)
-                is_changed = true;
-            else
-                threshold = mean * local_ratio;
-
-            if (depth < threshold) {
-                is_changed = true;
-                need_refresh = true;
+            }
+
+            vertices_[i].is_dead = true;
+            removed.push_back(i);
+        }
+
+        if (!removed.empty()) {
+            num_removed += removed.size();
+            affected.clear();
+            for (unsigned j = 0; j < removed.size(); ++j) {
+                AdjacentVertices_(vertices_[removed[j]], affected);
+            }
+
+            merged.clear();
+            Refresh_(&merged);
+            affected.insert(affected.end(), merged.begin(), merged.end());
+            for (unsigned j = 0; j < merged.size(); ++j) {
+                if (!vertices_[merged[j]].is_deleted) {
+                    AdjacentVertices_(vertices_[merged[j]], affected);
+                }
+            }
+
+            std::sort(affected.begin(), affected.end());
+            affected.erase(std::unique(affected.begin(), affected.end()), affected.end());
+            for (unsigned j = 0; j < affected.size(); ++j) {
+                double depth = RemovalDepth_(affected[j], min_len, local_width, local_ratio);
+                if (depth >= 0) {
+                    candidates.push(Candidate(depth, affected[j]));
+                }
+            }
+
+            min_depth *= 1.1;
+        } else {
+            // nothing to remove until the threshold passes the lowest candidate
+            while (!candidates.empty() && min_depth < max_depth && (int)min_depth <= candidates.top().first) {
+                min_depth *= 1.1;
+            }
+        }
+    }
+
+    return num_removed;
+}
+
+double UnitigGraph::RemovalDepth_(uint32_t vertex_id, int min_len, int local_width, double local_ratio) {
+    UnitigGraphVertex &vertex = vertices_[vertex_id];
+    int vertex_length = vertex.label_length - sdbg_->kmer_k + 1;
+    if (vertex.is_deleted || vertex_length >= min_len) { return -1; }
+    assert(vertex_length > 0);
+
+    int indegree = Indegree_(vertex.start_node);
+    int outdegree = Outdegree_(vertex, 0);
+
+    if (indegree + outdegree == 0) { return -1; }
+
+    if ((indegree <= 1 && outdegree <= 1) || indegree == 0 || outdegree == 0) {
+        double depth = (double)vertex.depth / vertex_length;
+        if (depth < LocalDepth_(vertex, local_width) * local_ratio) {
+            return depth;
+        }
+    }
+
+    return -1;
+}
+
+void UnitigGraph::AdjacentVertices_(UnitigGraphVertex &vertex, std::vector<uint32_t> &adjacent) {
+    for (int dir = 0; dir < 2; ++dir) {
+        int64_t outgoings[4];
+        int outdegree = Outgoings_(vertex, dir, outgoings);
+        for (int i = 0; i < outdegree; ++i) {
+            adjacent.push_back(StartNodeToVertex_(outgoings[i]));
+        }
+    }
+}
+
+int UnitigGraph::Indegree_(int64_t start_node) {
+    int64_t index = StartNodeIndex_(start_node);
+    int indegree = 0;
+    for (int64_t j = adj_offsets_[index]; j < adj_offsets_[index + 1]; ++j) {
+        indegree += adj_nodes_[j] != -1;
+    }
+    return indegree;
+}
+
+int UnitigGraph::Outgoings_(UnitigGraphVertex &vertex, int dir, int64_t *outgoings) {
+    int64_t index = StartNodeIndex_(dir == 0 ? vertex.rev_start_node : vertex.start_node);
+    int outdegree = 0;
+    for (int64_t j = adj_offsets_[index]; j < adj_offsets_[index + 1]; ++j) {
+        if (adj_nodes_[j] != -1) {
+            outgoings[outdegree++] = adj_nodes_[j];
+        }
+    }
+    return outdegree;
+}
+
+int64_t UnitigGraph::NextSimplePathStart_(UnitigGraphVertex &vertex, int dir) {
+    int64_t outgoings[4];
+    if (Outgoings_(vertex, dir, outgoings) == 1 && Indegree_(outgoings[0]) == 1) {
+        return outgoings[0];
+    } else {
+        return -1;
+    }
+}
+
+int64_t UnitigGraph::RemoveTips(int max_tip_len, int min_final_contig_len) {
+    int64_t num_removed = 0;
+
+    for (int len = 2; ; len *= 2) {
+        len = std::min(len, max_tip_len);
+        int64_t num_removed_this_round = 0;
+
+#pragma omp parallel for reduction(+:num_removed_this_round)
+        for (uint32_t i = 0; i < vertices_.size(); ++i) {
+            int num_nodes = vertices_[i].label_length - sdbg_->kmer_k + 1;
+            if (vertices_[i].is_deleted || num_nodes >= len) { continue; }
+
+            // a unitig is maximal, so a dead end attached to one side is attached to a branching node
+            int indegree = Indegree_(vertices_[i].start_node);
+            int outdegree = Outdegree_(vertices_[i], 0);
+            if ((indegree == 0 && outdegree == 1) || (indegree == 1 && outdegree == 0) ||
+                (indegree == 0 && outdegree == 0 && num_nodes + sdbg_->kmer_k - 1 < min_final_contig_len)) {
                 vertices_[i].is_dead = true;
-#pragma omp atomic
-                ++num_removed;
+                ++num_removed_this_round;
             }
         }
+
+        if (num_removed_this_round > 0) {
+            Refresh_();
+        }
+        num_removed += num_removed_this_round;
+
+        if (len == max_tip_len) { break; }
     }
 
-    if (need_refresh) {
+    return num_removed;
+}
+
+int64_t UnitigGraph::MergeBubbles(int max_bubble_len, double low_depth_ratio) {
+    const int kMaxBranchesPerGroup = 4;
+    int64_t num_bubbles = 0;
+    int64_t num_removed = 0;
+
+#pragma omp parallel for reduction(+:num_bubbles, num_removed)
+    for (uint32_t i = 0; i < vertices_.size(); ++i) {
+        if (vertices_[i].is_deleted) { continue; }
+
+        for (int dir = 0; dir < 2; ++dir) {
+            // begin node of the bubble is the end of this unitig, and each branch is one unitig
+            int64_t outgoings[4];
+            int outdegree = Outgoings_(vertices_[i], dir, outgoings);
+            if (outdegree < 2 || outdegree > kMaxBranchesPerGroup) {
+                continue;
+            }
+            if (vertices_[i].label_length == (unsigned)sdbg_->kmer_k && 
+                Indegree_(dir == 0 ? vertices_[i].start_node : vertices_[i].rev_start_node) != 1) {
+                continue;
+            }
+
+            uint32_t branches[4];
+            int64_t end_node = -1;
+            int branch_len = -1;
+            bool is_bubble = true;
+
+            for (int x = 0; x < outdegree && is_bubble; ++x) {
+                branches[x] = StartNodeToVertex_(outgoings[x]);
+                UnitigGraphVertex &branch = vertices_[branches[x]];
+                assert(!branch.is_deleted);
+
+                int num_nodes = branch.label_length - sdbg_->kmer_k + 1;
+                int64_t next_nodes[4];
+                int64_t next_node = Outgoings_(branch, branch.start_node == outgoings[x] ? 0 : 1, next_nodes) == 1 ? next_nodes[0] : -1;
+
+                if (branches[x] == i || Indegree_(outgoings[x]) != 1 || next_node == -1 ||
+                    (end_node != -1 && next_node != end_node) || (branch_len != -1 && num_nodes != branch_len)) {
+                    is_bubble = false;
+                }
+                for (int y = 0; y < x && is_bubble; ++y) {
+                    is_bubble = branches[y] != branches[x];
+                }
+                end_node = next_node;
+                branch_len = num_nodes;
+            }
+
+            if (!is_bubble || branch_len + 2 > max_bubble_len || Indegree_(end_node) != outdegree) {
+                continue;
+            }
+
+            // the same bubble is found from the reverse complement of the end vertex, only do it once
+            uint32_t end_vertex_id = StartNodeToVertex_(end_node);
+            UnitigGraphVertex &end_vertex = vertices_[end_vertex_id];
+            if (end_vertex_id <= i || (end_vertex.label_length == (unsigned)sdbg_->kmer_k && 
+                                       Outdegree_(end_vertex, end_vertex.start_node == end_node ? 0 : 1) != 1)) {
+                continue;
+            }
+
+            int64_t best_depth = 0;
+            for (int x = 0; x < outdegree; ++x) {
+                best_depth = std::max(best_depth, (int64_t)vertices_[branches[x]].depth);
+            }
+
+            int num_remained = 0;
+            for (int x = 0; x < outdegree; ++x) {
+                int64_t depth = vertices_[branches[x]].depth;
+                if (depth == best_depth || depth > low_depth_ratio * best_depth) {
+                    ++num_remained;
+                } else {
+                    vertices_[branches[x]].is_dead = true;
+                    ++num_removed;
+                }
+            }
+
+            if (num_remained == 1) {
+                ++num_bubbles;
+            }
+        }
+    }
+
+    if (num_removed > 0) {
         Refresh_();
     }
 
-    return is_changed;
+    return num_bubbles;
 }
 
 double UnitigGraph::LocalDepth_(UnitigGraphVertex &vertex, int local_width) {
@@ -287,14 +702,13 @@ double UnitigGraph::LocalDepth_(UnitigGraphVertex &vertex, int local_width) {
 
     for (int dir = 0; dir < 2; ++dir) {
         int64_t outgoings[4];
-        int outdegree = sdbg_->Outgoings(dir == 1 ? vertex.rev_end_node : vertex.end_node, outgoings);
+        int outdegree = Outgoings_(vertex, dir, outgoings);
         for (int i = 0; i < outdegree; ++i) {
-            auto next_vertex_iter = start_node_map_.find(outgoings[i]);
-            assert(next_vertex_iter != start_node_map_.end());
-            UnitigGraphVertex &next_vertex = vertices_[next_vertex_iter->second];
+            uint32_t next_vertex_id = StartNodeToVertex_(outgoings[i]);
+            UnitigGraphVertex &next_vertex = vertices_[next_vertex_id];
             assert(!next_vertex.is_deleted);
 
-            int vertex_length = next_vertex.label.length() - sdbg_->kmer_k + 1;
+            int vertex_length = next_vertex.label_length - sdbg_->kmer_k + 1;
             if (vertex_length <= local_width) {
                 num_added_kmer += vertex_length;
                 total_depth += next_vertex.depth;
@@ -309,9 +723,11 @@ double UnitigGraph::LocalDepth_(UnitigGraphVertex &vertex, int local_width) {
     else { return total_depth / num_added_kmer; }
 }
 
-void UnitigGraph::Refresh_() {
+void UnitigGraph::Refresh_(std::vector<uint32_t> *merged) {
     omp_lock_t reassemble_lock;
+    omp_lock_t merged_lock;
     omp_init_lock(&reassemble_lock);
+    omp_init_lock(&merged_lock);
     static AtomicBitVector marked;
     marked.reset(vertices_.size());
 
@@ -339,17 +755,35 @@ void UnitigGraph::Refresh_() {
                 sdbg_->SetInvalid(cur_node);
             }
 
+            // remove it from the adjacency of its neighbours
+            for (int dir = 0; dir < 2; ++dir) {
+                int64_t start_node = dir == 0 ? vertices_[i].start_node : vertices_[i].rev_start_node;
+                int64_t index = StartNodeIndex_(start_node);
+                for (int64_t j = adj_offsets_[index]; j < adj_offsets_[index + 1]; ++j) {
+                    if (adj_nodes_[j] == -1) { continue; }
+                    int64_t adj_index = StartNodeIndex_(adj_nodes_[j]);
+                    for (int64_t k = adj_offsets_[adj_index]; k < adj_offsets_[adj_index + 1]; ++k) {
+                        if (adj_nodes_[k] == start_node) {
+                            adj_nodes_[k] = -1;
+                        }
+                    }
+                }
+            }
+
             vertices_[i].is_deleted = true;
         }
     }
 
+    // search linear paths in parallel, the labels of them are assembled after the space in the arena is allocated
+    std::vector<std::vector<LinearPath> > linear_paths(omp_get_max_threads());
+
 #pragma omp parallel for
     for (uint32_t i = 0; i < vertices_.size(); ++i) {
         if (vertices_[i].is_deleted) { continue; }
         int dir;
-        if (assembly_algorithms::PrevSimplePathNode(*sdbg_, vertices_[i].start_node) == -1) {
+        if (NextSimplePathStart_(vertices_[i], 1) == -1) {
             dir = 0;
-        } else if (assembly_algorithms::PrevSimplePathNode(*sdbg_, vertices_[i].rev_start_node) == -1) {
+        } else if (NextSimplePathStart_(vertices_[i], 0) == -1) {
             dir = 1;
         } else {
             continue;
@@ -357,84 +791,91 @@ void UnitigGraph::Refresh_() {
 
         if (!marked.lock(i)) { continue; }
 
-        std::vector<std::pair<uint32_t, bool> > linear_path; // first: vertex_id, second: is_rc
-        int64_t cur_end = dir == 0 ? vertices_[i].end_node : vertices_[i].rev_end_node;
-        int64_t new_start = dir == 0 ? vertices_[i].start_node : vertices_[i].rev_start_node;
-        int64_t new_rc_end = dir == 0 ? vertices_[i].rev_end_node : vertices_[i].end_node;
+        LinearPath linear_path(i, dir);
+        uint32_t cur_vertex_id = i;
+        int cur_dir = dir;
 
         while (true) {
-            int64_t next_start = assembly_algorithms::NextSimplePathNode(*sdbg_, cur_end);
+            int64_t next_start = NextSimplePathStart_(vertices_[cur_vertex_id], cur_dir);
             if (next_start == -1) {
                 break;
             }
 
-            auto next_vertex_iter = start_node_map_.find(next_start);
-            assert(next_vertex_iter != start_node_map_.end());
-            UnitigGraphVertex &next_vertex = vertices_[next_vertex_iter->second];
+            uint32_t next_vertex_id = StartNodeToVertex_(next_start);
+            UnitigGraphVertex &next_vertex = vertices_[next_vertex_id];
             assert(!next_vertex.is_deleted);
 
             bool is_rc = next_vertex.start_node != next_start;
-            linear_path.push_back(std::make_pair(next_vertex_iter->second, is_rc));
+            linear_path.path.push_back(std::make_pair(next_vertex_id, is_rc));
 
-            cur_end = is_rc ? next_vertex.rev_end_node : next_vertex.end_node;
+            cur_vertex_id = next_vertex_id;
+            cur_dir = is_rc;
         }
 
-        if (linear_path.empty()) { continue; }
+        if (linear_path.path.empty()) { continue; }
 
-        bool palindrome = false;
-        if (i == linear_path.back().first) {
-            palindrome = true;
-        } else if (!marked.lock(linear_path.back().first)) {
-            if (linear_path.back().first > i) {
+        if (i != linear_path.path.back().first && !marked.lock(linear_path.path.back().first)) {
+            if (linear_path.path.back().first > i) {
                 marked.unset(i);
                 continue;
             } else {
-                while (!marked.lock(linear_path.back().first)) {
+                while (!marked.lock(linear_path.path.back().first)) {
                     // wait for the other thread release the lock
                 }
             }
         }
 
-        // assemble the linear path
+        linear_paths[omp_get_thread_num()].push_back(linear_path);
+    }
 
-        CompactSequence label = vertices_[i].label; 
-        int64_t depth = vertices_[i].depth; 
-        if (dir == 1) {
-            label.ReverseComplement();
+    // allocate the labels of the assembled paths
+    std::vector<LinearPath*> assembled_paths;
+    for (unsigned t = 0; t < linear_paths.size(); ++t) {
+        for (unsigned j = 0; j < linear_paths[t].size(); ++j) {
+            LinearPath &linear_path = linear_paths[t][j];
+            uint32_t label_length = vertices_[linear_path.vertex_id].label_length;
+            for (unsigned x = 0; x < linear_path.path.size(); ++x) {
+                label_length += vertices_[linear_path.path[x].first].label_length - (sdbg_->kmer_k - 1);
+            }
+            linear_path.label_length = label_length;
+            linear_path.label_offset = AllocateLabel_(label_arena_, label_length);
+            assembled_paths.push_back(&linear_path);
         }
+    }
 
-        for (unsigned j = 0; j < linear_path.size(); ++j) {
-            UnitigGraphVertex &next_vertex = vertices_[linear_path[j].first];
-            if (linear_path[j].second) {
-                next_vertex.label.ReverseComplement();
-            }
-            // assert(label.substr(label.length() - sdbg_->kmer_k + 1) == next_vertex.label.substr(0, sdbg_->kmer_k - 1));
-            label.resize(label.length() - sdbg_->kmer_k + 1);
-            label.Append(next_vertex.label);
+    // assemble the linear paths
+#pragma omp parallel for
+    for (unsigned j = 0; j < assembled_paths.size(); ++j) {
+        LinearPath &linear_path = *assembled_paths[j];
+        uint32_t i = linear_path.vertex_id;
+        int dir = linear_path.dir;
+        std::vector<std::pair<uint32_t, bool> > &path = linear_path.path;
 
-            if (palindrome && linear_path[j].second) {
-                next_vertex.label.ReverseComplement();
-            }
+        int64_t new_start = dir == 0 ? vertices_[i].start_node : vertices_[i].rev_start_node;
+        int64_t new_rc_end = dir == 0 ? vertices_[i].rev_end_node : vertices_[i].end_node;
+        int64_t label_pos = CopyLabel_(vertices_[i], dir == 1, 0, linear_path.label_offset);
+        int64_t depth = vertices_[i].depth;
 
+        for (unsigned x = 0; x < path.size(); ++x) {
+            UnitigGraphVertex &next_vertex = vertices_[path[x].first];
+            label_pos = CopyLabel_(next_vertex, path[x].second, sdbg_->kmer_k - 1, label_pos);
             depth += next_vertex.depth;
             next_vertex.is_deleted = true;
         }
+        assert(label_pos == linear_path.label_offset + linear_path.label_length);
 
-        for (unsigned j = 0; j < linear_path.size(); ++j) {
-            CompactSequence empty_str;
-            vertices_[linear_path[j].first].label.swap(empty_str);
-        }
-        vertices_[i].label = label;
+        vertices_[i].label_offset = linear_path.label_offset;
+        vertices_[i].label_length = linear_path.label_length;
         vertices_[i].depth = depth;
 
         int64_t new_end;
         int64_t new_rc_start;
-        if (linear_path.back().second) {
-            new_end = vertices_[linear_path.back().first].rev_end_node;
-            new_rc_start = vertices_[linear_path.back().first].start_node;
+        if (path.back().second) {
+            new_end = vertices_[path.back().first].rev_end_node;
+            new_rc_start = vertices_[path.back().first].start_node;
         } else {
-            new_end = vertices_[linear_path.back().first].end_node;
-            new_rc_start = vertices_[linear_path.back().first].rev_start_node;
+            new_end = vertices_[path.back().first].end_node;
+            new_rc_start = vertices_[path.back().first].rev_start_node;
         }
 
         vertices_[i].start_node = new_start;
@@ -442,9 +883,15 @@ void UnitigGraph::Refresh_() {
         vertices_[i].rev_start_node = new_rc_start;
         vertices_[i].rev_end_node = new_rc_end;
         vertices_[i].is_changed = true;
-        if (i == linear_path.back().first) {
+        if (i == path.back().first) {
             vertices_[i].is_deleted = false;
         }
+
+        if (merged != NULL) {
+            omp_set_lock(&merged_lock);
+            merged->push_back(i);
+            omp_unset_lock(&merged_lock);
+        }
     }
 
     // looped path
@@ -453,44 +900,44 @@ void UnitigGraph::Refresh_() {
         if (!vertices_[i].is_deleted && !marked.get(i)) {
             omp_set_lock(&reassemble_lock);
             if (!vertices_[i].is_deleted && !marked.get(i)) {
-                CompactSequence &label = vertices_[i].label;
+                CompactSequence label;
+                GetLabel_(vertices_[i], label);
                 int64_t depth = vertices_[i].depth;
-                int vertex_length = vertices_[i].label.length() - sdbg_->kmer_k + 1;
+                int vertex_length = vertices_[i].label_length - sdbg_->kmer_k + 1;
 
                 vertices_[i].is_changed = true;
                 vertices_[i].is_loop = true;
                 vertices_[i].is_deleted = true;
 
                 for (int dir = 0; dir < 2; ++dir) {
-                    int64_t cur_end = vertices_[i].end_node;
-                    if (dir == 1) { cur_end = vertices_[i].rev_end_node; }
                     while (true) {
-                        int64_t next_start = assembly_algorithms::NextSimplePathNode(*sdbg_, cur_end);
+                        int64_t next_start = NextSimplePathStart_(vertices_[i], dir);
                         assert(next_start != -1);
-                        auto next_vertex_iter = start_node_map_.find(next_start);
-                        assert(next_vertex_iter != start_node_map_.end());
-                        UnitigGraphVertex &next_vertex = vertices_[next_vertex_iter->second];
+                        uint32_t next_vertex_id = StartNodeToVertex_(next_start);
+                        UnitigGraphVertex &next_vertex = vertices_[next_vertex_id];
                         if (next_vertex.is_deleted) { break; }
 
+                        CompactSequence next_label;
+                        GetLabel_(next_vertex, next_label);
                         if (next_vertex.start_node != next_start) {
-                            next_vertex.label.ReverseComplement();
+                            next_label.ReverseComplement();
                         }
 
-                        // assert(label.substr(label.length() - sdbg_->kmer_k + 1) == next_vertex.label.substr(0, sdbg_->kmer_k - 1));
+                        // assert(label.substr(label.length() - sdbg_->kmer_k + 1) == next_label.substr(0, sdbg_->kmer_k - 1));
                         label.resize(label.length() - sdbg_->kmer_k + 1);
-                        label.Append(next_vertex.label);
+                        label.Append(next_label);
 
                         depth += next_vertex.depth;
-                        vertex_length += next_vertex.label.length() - sdbg_->kmer_k + 1;
+                        vertex_length += next_vertex.label_length - sdbg_->kmer_k + 1;
 
                         next_vertex.is_deleted = true;
-
-                        CompactSequence empty_str;
-                        next_vertex.label.swap(empty_str);
                     }
                     label.ReverseComplement();
                 }
 
+                vertices_[i].label_offset = AppendLabel_(label_arena_, label);
+                vertices_[i].label_length = label.length();
+
                 vertices_[i].depth = depth * 1.0 / vertex_length + 0.5;
             }
             omp_unset_lock(&reassemble_lock);
@@ -500,146 +947,182 @@ void UnitigGraph::Refresh_() {
 #pragma omp parallel for
     for (uint32_t i = 0; i < vertices_.size(); ++i) {
         if (!vertices_[i].is_deleted) {
-            start_node_map_[vertices_[i].rev_start_node] = i;
+            SetStartNodeVertex_(vertices_[i].rev_start_node, i);
         }
     }
 
+    omp_destroy_lock(&merged_lock);
     omp_destroy_lock(&reassemble_lock);
+
+    CompactLabels_();
+}
+
+int64_t UnitigGraph::AllocateLabel_(std::vector<uint64_t> &arena, uint32_t label_length) {
+    int64_t offset = arena.size() * kBasesPerLabelWord;
+    arena.resize(arena.size() + (label_length + kBasesPerLabelWord - 1) / kBasesPerLabelWord, 0);
+    return offset;
+}
+
+int64_t UnitigGraph::AppendLabel_(std::vector<uint64_t> &arena, const CompactSequence &label) {
+    int64_t offset = AllocateLabel_(arena, label.length());
+    CompactSequence::CopyBases(label.data(), 0, label.length(), arena.data(), offset);
+    return offset;
+}
+
+int64_t UnitigGraph::CopyLabel_(UnitigGraphVertex &vertex, bool is_rc, uint32_t skip, int64_t pos) {
+    if (is_rc) {
+        CompactSequence::CopyReverseComplement(label_arena_.data(), vertex.label_offset, vertex.label_length - skip,
+                                               label_arena_.data(), pos);
+    } else {
+        CompactSequence::CopyBases(label_arena_.data(), vertex.label_offset + skip, vertex.label_length - skip,
+                                   label_arena_.data(), pos);
+    }
+    return pos + vertex.label_length - skip;
+}
+
+void UnitigGraph::GetLabel_(UnitigGraphVertex &vertex, CompactSequence &label) {
+    label.clear();
+    label.Append(label_arena_.data(), vertex.label_offset, vertex.label_length);
+}
+
+std::string UnitigGraph::LabelToDNAString_(UnitigGraphVertex &vertex) {
+    std::string dna(vertex.label_length, 'N');
+    if (!dna.empty()) {
+        CompactSequence::DecodeBases(label_arena_.data(), vertex.label_offset, vertex.label_length, &dna[0]);
+    }
+    return dna;
+}
+
+void UnitigGraph::CompactLabels_() {
+    // labels of the vertices merged or removed are garbage, move the others to a new arena if they take less than half
+    size_t num_words = 0;
+    for (uint32_t i = 0; i < vertices_.size(); ++i) {
+        if (!vertices_[i].is_deleted || vertices_[i].is_loop) {
+            num_words += (vertices_[i].label_length + kBasesPerLabelWord - 1) / kBasesPerLabelWord;
+        }
+    }
+    if (num_words * 2 > label_arena_.size()) { return; }
+
+    std::vector<uint64_t> new_arena(num_words);
+    num_words = 0;
+    for (uint32_t i = 0; i < vertices_.size(); ++i) {
+        if (!vertices_[i].is_deleted || vertices_[i].is_loop) {
+            size_t label_words = (vertices_[i].label_length + kBasesPerLabelWord - 1) / kBasesPerLabelWord;
+            std::copy(label_arena_.begin() + vertices_[i].label_offset / kBasesPerLabelWord, 
+                      label_arena_.begin() + vertices_[i].label_offset / kBasesPerLabelWord + label_words, 
+                      new_arena.begin() + num_words);
+            vertices_[i].label_offset = num_words * kBasesPerLabelWord;
+            num_words += label_words;
+        }
+    }
+    label_arena_.swap(new_arena);
 }
 
 void UnitigGraph::OutputInitUnitigs(FILE *contig_file, FILE *multi_file, std::map<int64_t, int> &histo) {
-    uint32_t output_id = 0;
-    omp_lock_t output_lock;
-    omp_init_lock(&output_lock);
+    OrderedContigWriter writer(">contig", contig_file, multi_file);
     histo.clear();
 
-#pragma omp parallel for
-    for (unsigned i = 0; i < vertices_.size(); ++i) {
-        uint16_t multi;
-        if (vertices_[i].is_loop) {
-            multi = std::min(kMaxMulti_t, int(vertices_[i].depth + 0.5));
-        } else {
-            double dbg_vertex_length = vertices_[i].label.length() - sdbg_->kmer_k + 1;
-            multi = std::min(kMaxMulti_t, int(vertices_[i].depth / dbg_vertex_length + 0.5)); 
-        }
-
-        std::string label = vertices_[i].label.ToDNAString();
-
-        if (vertices_[i].is_loop) {
-            omp_set_lock(&output_lock);
-            fprintf(contig_file, ">contig%d_length_%ld_multi_%d_loop\n%s\n", 
-                                 output_id,
-                                 label.length(),
-                                 multi,
-                                 label.c_str());
-            fwrite(&multi, sizeof(uint16_t), 1, multi_file);
-            ++output_id;
-            ++histo[vertices_[i].label.length()];
-            omp_unset_lock(&output_lock);
-        } else {
-            int indegree = sdbg_->Indegree(vertices_[i].start_node);
-            int outdegree = sdbg_->Outdegree(vertices_[i].end_node);
-            if (indegree == 0 && outdegree == 0) {
-                vertices_[i].is_deleted = true;
+    for (uint32_t begin = 0; begin < vertices_.size(); begin += OrderedContigWriter::kBatchSize) {
+        uint32_t end = std::min((uint32_t)vertices_.size(), begin + OrderedContigWriter::kBatchSize);
+
+#pragma omp parallel for schedule(static)
+        for (uint32_t i = begin; i < end; ++i) {
+            if (vertices_[i].is_deleted && !vertices_[i].is_loop) {
+                continue;
             }
-            omp_set_lock(&output_lock);
-            fprintf(contig_file, ">contig%d_length_%ld_multi_%d_in_%d_out_%d\n%s\n", 
-                                 output_id, 
-                                 label.length(), 
-                                 multi, 
-                                 indegree, 
-                                 outdegree, 
-                                 label.c_str());
-            fwrite(&multi, sizeof(uint16_t), 1, multi_file);
-            ++output_id;
-            ++histo[vertices_[i].label.length()];
-            omp_unset_lock(&output_lock);
-        }
+            // changes made by simplification are included in the initial output
+            vertices_[i].is_changed = false;
 
-        if (vertices_[i].is_deleted) {
-            CompactSequence empty_str;
-            vertices_[i].label.swap(empty_str);
+            uint16_t multi;
+            if (vertices_[i].is_loop) {
+                multi = std::min(kMaxMulti_t, int(vertices_[i].depth + 0.5));
+            } else {
+                double dbg_vertex_length = vertices_[i].label_length - sdbg_->kmer_k + 1;
+                multi = std::min(kMaxMulti_t, int(vertices_[i].depth / dbg_vertex_length + 0.5)); 
+            }
+
+            std::string label = LabelToDNAString_(vertices_[i]);
+            char header[128];
+
+            if (vertices_[i].is_loop) {
+                sprintf(header, "_length_%ld_multi_%d_loop", label.length(), multi);
+            } else {
+                int indegree = Indegree_(vertices_[i].start_node);
+                int outdegree = Outdegree_(vertices_[i], 0);
+                if (indegree == 0 && outdegree == 0) {
+                    vertices_[i].is_deleted = true;
+                }
+                sprintf(header, "_length_%ld_multi_%d_in_%d_out_%d", label.length(), multi, indegree, outdegree);
+            }
+
+            writer.Append(header, label, multi);
+            ++writer.histo()[vertices_[i].label_length];
         }
+
+        writer.Flush();
     }
 
-    omp_destroy_lock(&output_lock);
+    writer.MergeHisto(histo);
 }
 
 void UnitigGraph::OutputChangedUnitigs(FILE *add_contig_file, FILE *addi_multi_file, std::map<int64_t, int> &histo) {
-    uint32_t output_id = 0;
-    omp_lock_t output_lock;
-    omp_lock_t histo_lock;
-    omp_init_lock(&output_lock);
-    omp_init_lock(&histo_lock);
+    OrderedContigWriter writer(">addi", add_contig_file, addi_multi_file);
     histo.clear();
 
-#pragma omp parallel for
-    for (unsigned i = 0; i < vertices_.size(); ++i) {
-        if ((vertices_[i].is_deleted && !vertices_[i].is_loop)) {
-            continue;
-        }
+    for (uint32_t begin = 0; begin < vertices_.size(); begin += OrderedContigWriter::kBatchSize) {
+        uint32_t end = std::min((uint32_t)vertices_.size(), begin + OrderedContigWriter::kBatchSize);
+
+#pragma omp parallel for schedule(static)
+        for (uint32_t i = begin; i < end; ++i) {
+            if ((vertices_[i].is_deleted && !vertices_[i].is_loop)) {
+                continue;
+            }
 
-        omp_set_lock(&histo_lock);
-        ++histo[vertices_[i].label.length()];
-        omp_unset_lock(&histo_lock);
+            ++writer.histo()[vertices_[i].label_length];
 
-        if (!vertices_[i].is_changed) { continue; }
+            if (!vertices_[i].is_changed) { continue; }
 
-        uint16_t multi;
-        if (vertices_[i].is_loop) {
-            multi = std::min(kMaxMulti_t, int(vertices_[i].depth + 0.5));
-        } else {
-            double dbg_vertex_length = vertices_[i].label.length() - sdbg_->kmer_k + 1;
-            multi = std::min(kMaxMulti_t, int(vertices_[i].depth / dbg_vertex_length + 0.5)); 
-        }
+            uint16_t multi;
+            if (vertices_[i].is_loop) {
+                multi = std::min(kMaxMulti_t, int(vertices_[i].depth + 0.5));
+            } else {
+                double dbg_vertex_length = vertices_[i].label_length - sdbg_->kmer_k + 1;
+                multi = std::min(kMaxMulti_t, int(vertices_[i].depth / dbg_vertex_length + 0.5)); 
+            }
 
-        std::string label = vertices_[i].label.ToDNAString();
+            std::string label = LabelToDNAString_(vertices_[i]);
+            char header[128];
 
-        if (vertices_[i].is_loop) {
-            if (label.length() >= (unsigned)sdbg_->kmer_k && 
-                label.substr(label.length() - sdbg_->kmer_k + 1) == label.substr(0, sdbg_->kmer_k - 1)) {
-                int num_vertex = label.length() - sdbg_->kmer_k + 1;
-                if (num_vertex < sdbg_->kmer_k + 1) {
-                    continue;
-                }
-                // WARN: hard code 28: the maximum step
-                unsigned max_next_k = 28 + sdbg_->kmer_k;
-                int j = sdbg_->kmer_k - 1;
-                while (label.length() <= max_next_k + 1 ||
-                       label.substr(0, max_next_k + 1) != label.substr(label.length() - max_next_k - 1)) {
-                    label.push_back(label[j]);
-                    ++j;
+            if (vertices_[i].is_loop) {
+                if (label.length() >= (unsigned)sdbg_->kmer_k && 
+                    label.substr(label.length() - sdbg_->kmer_k + 1) == label.substr(0, sdbg_->kmer_k - 1)) {
+                    int num_vertex = label.length() - sdbg_->kmer_k + 1;
+                    if (num_vertex < sdbg_->kmer_k + 1) {
+                        continue;
+                    }
+                    // WARN: hard code 28: the maximum step
+                    unsigned max_next_k = 28 + sdbg_->kmer_k;
+                    int j = sdbg_->kmer_k - 1;
+                    while (label.length() <= max_next_k + 1 ||
+                           label.substr(0, max_next_k + 1) != label.substr(label.length() - max_next_k - 1)) {
+                        label.push_back(label[j]);
+                        ++j;
+                    }
                 }
+                sprintf(header, "_length_%ld_multi_%d_loop", label.length(), multi);
+            } else {
+                int indegree = Indegree_(vertices_[i].start_node);
+                int outdegree = Outdegree_(vertices_[i], 0);
+                sprintf(header, "_length_%ld_multi_%d_in_%d_out_%d", label.length(), multi, indegree, outdegree);
             }
-            omp_set_lock(&output_lock);
-            fprintf(add_contig_file, ">addi%d_length_%ld_multi_%d_loop\n%s\n", 
-                                 output_id, 
-                                 label.length(),
-                                 multi, 
-                                 label.c_str());
-            fwrite(&multi, sizeof(uint16_t), 1, addi_multi_file);
-            ++output_id;
-            omp_unset_lock(&output_lock);
-        } else {
-            int indegree = sdbg_->Indegree(vertices_[i].start_node);
-            int outdegree = sdbg_->Outdegree(vertices_[i].end_node);
-            omp_set_lock(&output_lock);
-            fprintf(add_contig_file, ">addi%d_length_%ld_multi_%d_in_%d_out_%d\n%s\n", 
-                                 output_id, 
-                                 label.length(), 
-                                 multi,
-                                 indegree,
-                                 outdegree,
-                                 label.c_str());
-            fwrite(&multi, sizeof(uint16_t), 1, addi_multi_file);
-            ++output_id;
-            omp_unset_lock(&output_lock);
+
+            writer.Append(header, label, multi);
         }
 
+        writer.Flush();
     }
 
-    omp_destroy_lock(&histo_lock);
-    omp_destroy_lock(&output_lock);
+    writer.MergeHisto(histo);
 }
 
 void UnitigGraph::OutputInitUnitigs(FILE *contig_file, 
@@ -648,159 +1131,129 @@ void UnitigGraph::OutputInitUnitigs(FILE *contig_file,
                                     std::map<int64_t, int> &histo,
                                     int min_final_contig_length) {
 
-    uint32_t output_id = 0;
-    omp_lock_t output_lock;
-    omp_init_lock(&output_lock);
+    char id_prefix[32];
+    sprintf(id_prefix, ">contig_%d_", sdbg_->kmer_k);
+    OrderedContigWriter writer(id_prefix, contig_file, multi_file, final_contig_file);
     histo.clear();
 
-#pragma omp parallel for
-    for (unsigned i = 0; i < vertices_.size(); ++i) {
-        uint16_t multi;
-        if (vertices_[i].is_loop) {
-            multi = std::min(kMaxMulti_t, int(vertices_[i].depth + 0.5));
-        } else {
-            double dbg_vertex_length = vertices_[i].label.length() - sdbg_->kmer_k + 1;
-            multi = std::min(kMaxMulti_t, int(dbg_vertex_length == 1 ? 0 : vertices_[i].depth / (dbg_vertex_length - 1) + 0.5));
-        }
+    for (uint32_t begin = 0; begin < vertices_.size(); begin += OrderedContigWriter::kBatchSize) {
+        uint32_t end = std::min((uint32_t)vertices_.size(), begin + OrderedContigWriter::kBatchSize);
 
-        std::string label = vertices_[i].label.ToDNAString();
-
-        if (vertices_[i].is_loop) {
-            if (label.length() < (unsigned)min_final_contig_length) {
+#pragma omp parallel for schedule(static)
+        for (uint32_t i = begin; i < end; ++i) {
+            if (vertices_[i].is_deleted && !vertices_[i].is_loop) {
                 continue;
             }
-            omp_set_lock(&output_lock);
-            fprintf(final_contig_file, ">contig_%d_%d_length_%ld_multi_%d_loop\n%s\n", 
-                                 sdbg_->kmer_k,
-                                 output_id, 
-                                 label.length(),
-                                 multi,
-                                 label.c_str());
-            ++output_id;
-            ++histo[label.length()];
-            omp_unset_lock(&output_lock);
-        } else {
-            int indegree = sdbg_->Indegree(vertices_[i].start_node);
-            int outdegree = sdbg_->Outdegree(vertices_[i].end_node);
-            FILE *out_file = contig_file;
-            if (indegree == 0 && outdegree == 0) {
-                vertices_[i].is_deleted = true;
-                if (vertices_[i].start_node == vertices_[i].rev_start_node) {
-                    // palindrome
-                    int num_kmer = label.length() - sdbg_->kmer_k + 1;
-                    assert(num_kmer % 2 == 0);
-                    label.resize(num_kmer / 2 + (sdbg_->kmer_k - 1));
-                }
+            // changes made by simplification are included in the initial output
+            vertices_[i].is_changed = false;
 
-                if (label.length() >= (unsigned)min_final_contig_length) {
-                    out_file = final_contig_file;
-                } else {
+            uint16_t multi;
+            if (vertices_[i].is_loop) {
+                multi = std::min(kMaxMulti_t, int(vertices_[i].depth + 0.5));
+            } else {
+                double dbg_vertex_length = vertices_[i].label_length - sdbg_->kmer_k + 1;
+                multi = std::min(kMaxMulti_t, int(dbg_vertex_length == 1 ? 0 : vertices_[i].depth / (dbg_vertex_length - 1) + 0.5));
+            }
+
+            std::string label = LabelToDNAString_(vertices_[i]);
+            char header[128];
+
+            if (vertices_[i].is_loop) {
+                if (label.length() < (unsigned)min_final_contig_length) {
                     continue;
                 }
-            }
+                sprintf(header, "_length_%ld_multi_%d_loop", label.length(), multi);
+                writer.Append(header, label, multi, true);
+            } else {
+                int indegree = Indegree_(vertices_[i].start_node);
+                int outdegree = Outdegree_(vertices_[i], 0);
+                bool is_final = false;
+                if (indegree == 0 && outdegree == 0) {
+                    vertices_[i].is_deleted = true;
+                    if (vertices_[i].start_node == vertices_[i].rev_start_node) {
+                        // palindrome
+                        int num_kmer = label.length() - sdbg_->kmer_k + 1;
+                        assert(num_kmer % 2 == 0);
+                        label.resize(num_kmer / 2 + (sdbg_->kmer_k - 1));
+                    }
+
+                    if (label.length() >= (unsigned)min_final_contig_length) {
+                        is_final = true;
+                    } else {
+                        continue;
+                    }
+                }
 
-            omp_set_lock(&output_lock);
-            fprintf(out_file, ">contig_%d_%d_length_%ld_multi_%d_in_%d_out_%d\n%s\n", 
-                                 sdbg_->kmer_k,
-                                 output_id, 
-                                 label.length(), 
-                                 multi, 
-                                 indegree, 
-                                 outdegree, 
-                                 label.c_str());
-            if (out_file == contig_file) {
-                fwrite(&multi, sizeof(uint16_t), 1, multi_file);
+                sprintf(header, "_length_%ld_multi_%d_in_%d_out_%d", label.length(), multi, indegree, outdegree);
+                writer.Append(header, label, multi, is_final);
             }
-            ++output_id;
-            ++histo[label.length()];
-            omp_unset_lock(&output_lock);
-        }
 
-        if (vertices_[i].is_deleted) {
-            CompactSequence empty_str;
-            vertices_[i].label.swap(empty_str);
+            ++writer.histo()[label.length()];
         }
+
+        writer.Flush();
     }
 
-    omp_destroy_lock(&output_lock);
+    writer.MergeHisto(histo);
 }
 
 void UnitigGraph::OutputFinalUnitigs(FILE *final_contig_file,
                                      std::map<int64_t, int> &histo,
                                      int min_final_contig_length) {
-    uint32_t output_id = 0;
-    omp_lock_t output_lock;
-    omp_init_lock(&output_lock);
+    char id_prefix[32];
+    sprintf(id_prefix, ">contig_%d_", sdbg_->kmer_k);
+    OrderedContigWriter writer(id_prefix, final_contig_file, NULL);
     histo.clear();
 
-#pragma omp parallel for
-    for (unsigned i = 0; i < vertices_.size(); ++i) {
-        if ((vertices_[i].is_deleted && !vertices_[i].is_loop)) {
-            continue;
-        }
-        
-        uint16_t multi;
-        if (vertices_[i].is_loop) {
-            multi = std::min(kMaxMulti_t, int(vertices_[i].depth + 0.5));
-        } else {
-            double dbg_vertex_length = vertices_[i].label.length() - sdbg_->kmer_k + 1;
-            multi = std::min(kMaxMulti_t, int(dbg_vertex_length == 1 ? 0 : vertices_[i].depth / (dbg_vertex_length - 1) + 0.5)); 
-        }
-
-        std::string label = vertices_[i].label.ToDNAString();
+    for (uint32_t begin = 0; begin < vertices_.size(); begin += OrderedContigWriter::kBatchSize) {
+        uint32_t end = std::min((uint32_t)vertices_.size(), begin + OrderedContigWriter::kBatchSize);
 
-        if (vertices_[i].is_loop) {
-            if (label.length() < (unsigned)min_final_contig_length) {
+#pragma omp parallel for schedule(static)
+        for (uint32_t i = begin; i < end; ++i) {
+            if ((vertices_[i].is_deleted && !vertices_[i].is_loop)) {
                 continue;
             }
-            omp_set_lock(&output_lock);
-            fprintf(final_contig_file, ">contig_%d_%d_length_%ld_multi_%d_loop\n%s\n", 
-                                 sdbg_->kmer_k,
-                                 output_id, 
-                                 label.length(),
-                                 multi, 
-                                 label.c_str());
-            ++histo[label.length()];
-            ++output_id;
-            omp_unset_lock(&output_lock);
-        } else if (vertices_[i].start_node == vertices_[i].rev_start_node) {
-            // it is a palindrome
-            int num_kmer = label.length() - sdbg_->kmer_k + 1;
-            assert(num_kmer % 2 == 0);
-            label.resize(num_kmer / 2 + (sdbg_->kmer_k - 1));
-            if (label.length() < (unsigned)min_final_contig_length) {
-                continue;
+            
+            uint16_t multi;
+            if (vertices_[i].is_loop) {
+                multi = std::min(kMaxMulti_t, int(vertices_[i].depth + 0.5));
+            } else {
+                double dbg_vertex_length = vertices_[i].label_length - sdbg_->kmer_k + 1;
+                multi = std::min(kMaxMulti_t, int(dbg_vertex_length == 1 ? 0 : vertices_[i].depth / (dbg_vertex_length - 1) + 0.5)); 
             }
-            omp_set_lock(&output_lock);
-            fprintf(final_contig_file, ">contig_%d_%d_length_%ld_multi_%d_palindrome\n%s\n", 
-                                 sdbg_->kmer_k,
-                                 output_id, 
-                                 label.length(),
-                                 multi, 
-                                 label.c_str());
-            ++output_id;
-            ++histo[label.length()];
-            omp_unset_lock(&output_lock);
-        } else {
-            int indegree = sdbg_->Indegree(vertices_[i].start_node);
-            int outdegree = sdbg_->Outdegree(vertices_[i].end_node);
-            if (label.length() < (unsigned)min_final_contig_length) {
-                continue;
+
+            std::string label = LabelToDNAString_(vertices_[i]);
+            char header[128];
+
+            if (vertices_[i].is_loop) {
+                if (label.length() < (unsigned)min_final_contig_length) {
+                    continue;
+                }
+                sprintf(header, "_length_%ld_multi_%d_loop", label.length(), multi);
+            } else if (vertices_[i].start_node == vertices_[i].rev_start_node) {
+                // it is a palindrome
+                int num_kmer = label.length() - sdbg_->kmer_k + 1;
+                assert(num_kmer % 2 == 0);
+                label.resize(num_kmer / 2 + (sdbg_->kmer_k - 1));
+                if (label.length() < (unsigned)min_final_contig_length) {
+                    continue;
+                }
+                sprintf(header, "_length_%ld_multi_%d_palindrome", label.length(), multi);
+            } else {
+                int indegree = Indegree_(vertices_[i].start_node);
+                int outdegree = Outdegree_(vertices_[i], 0);
+                if (label.length() < (unsigned)min_final_contig_length) {
+                    continue;
+                }
+                sprintf(header, "_length_%ld_multi_%d_in_%d_out_%d", label.length(), multi, indegree, outdegree);
             }
-            omp_set_lock(&output_lock);
-            fprintf(final_contig_file, ">contig_%d_%d_length_%ld_multi_%d_in_%d_out_%d\n%s\n", 
-                                 sdbg_->kmer_k,
-                                 output_id, 
-                                 label.length(), 
-                                 multi, 
-                                 indegree, 
-                                 outdegree, 
-                                 label.c_str());
-            ++output_id;
-            ++histo[label.length()];
-            omp_unset_lock(&output_lock);
+
+            writer.Append(header, label, multi);
+            ++writer.histo()[label.length()];
         }
+
+        writer.Flush();
     }
 
-    omp_destroy_lock(&output_lock);
-}
\ No newline at end of file
+    writer.MergeHisto(histo);
+}
@@ -24,14 +24,16 @@
 #include <limits>
 #include <assert.h>
 
-#include "hash_map.h"
 #include "compact_sequence.h"
+#include "atomic_bit_vector.h"
+#include "rank_and_select.h"
 
 class SuccinctDBG;
 struct UnitigGraphVertex {
     UnitigGraphVertex(int64_t start_node, int64_t end_node, 
-        int64_t rev_start_node, int64_t rev_end_node, int64_t depth, const CompactSequence &label): 
-            start_node(start_node), end_node(end_node), rev_start_node(rev_start_node), rev_end_node(rev_end_node), depth(depth), label(label) {
+        int64_t rev_start_node, int64_t rev_end_node, int64_t depth, int64_t label_offset, uint32_t label_length): 
+            start_node(start_node), end_node(end_node), rev_start_node(rev_start_node), rev_end_node(rev_end_node), depth(depth), 
+            label_offset(label_offset), label_length(label_length) {
 
         is_deleted = false;
         is_changed = false;
@@ -46,7 +48,8 @@ struct UnitigGraphVertex {
     bool is_changed: 1;
     bool is_dead: 1;
     bool is_loop: 1;
-    CompactSequence label;
+    int64_t label_offset; // position of the first base in the label arena of the graph
+    uint32_t label_length;
 };
 
 class UnitigGraph {
@@ -56,7 +59,12 @@ public:
 
     void InitFromSdBG();
     uint32_t size() { return vertices_.size(); }
-    bool RemoveLocalLowDepth(int min_depth, int min_len, int local_width, double local_ratio, int64_t &num_removed);
+    // progressively remove short vertices whose depth is lower than both the raising threshold (from min_depth
+    // to max_depth) and local_ratio times the depth of their neighbourhood; return the number removed
+    int64_t RemoveLocalLowDepth(double min_depth, double max_depth, int min_len, int local_width, double local_ratio);
+    // simplification on unitigs, equivalent to tips removal and bubble merging on the SdBG
+    int64_t RemoveTips(int max_tip_len, int min_final_contig_len);
+    int64_t MergeBubbles(int max_bubble_len, double low_depth_ratio);
 
     // output without final file, for test only
     void OutputInitUnitigs(FILE *contig_file, FILE *multi_file, std::map<int64_t, int> &histo);
@@ -70,14 +78,67 @@ public:
 private:
     // functions
     double LocalDepth_(UnitigGraphVertex &path, int local_width);
-    void Refresh_();
+    double RemovalDepth_(uint32_t vertex_id, int min_len, int local_width, double local_ratio); // -1 if not removable
+    void AdjacentVertices_(UnitigGraphVertex &vertex, std::vector<uint32_t> &adjacent);
+    void Refresh_(std::vector<uint32_t> *merged = NULL); // merged: ids of vertices rebuilt from linear paths
+
+    // labels are packed in 2 bits per base in the arena, each of them starts at a word boundary
+    uint8_t LabelBase_(int64_t pos) {
+        return (label_arena_[pos / kBasesPerLabelWord] >> (pos % kBasesPerLabelWord * 2)) & 3;
+    }
+    static int64_t AllocateLabel_(std::vector<uint64_t> &arena, uint32_t label_length);
+    static int64_t AppendLabel_(std::vector<uint64_t> &arena, const CompactSequence &label);
+    // copy the label of vertex, with its first skip bases dropped, to pos of the arena; return the end position
+    int64_t CopyLabel_(UnitigGraphVertex &vertex, bool is_rc, uint32_t skip, int64_t pos);
+    void GetLabel_(UnitigGraphVertex &vertex, CompactSequence &label);
+    std::string LabelToDNAString_(UnitigGraphVertex &vertex);
+    void CompactLabels_();
+
+    int64_t StartNodeIndex_(int64_t start_node) {
+        assert(is_start_node_.get(start_node));
+        return start_node_rank_.Rank(start_node) - 1;
+    }
+
+    uint32_t StartNodeToVertex_(int64_t start_node) {
+        return start_node_vertex_[StartNodeIndex_(start_node)];
+    }
+
+    void SetStartNodeVertex_(int64_t start_node, uint32_t vertex_id) {
+        start_node_vertex_[StartNodeIndex_(start_node)] = vertex_id;
+    }
+
+    // degrees and neighbours from the adjacency, dir 0: from end_node; dir 1: from rev_end_node
+    int Indegree_(int64_t start_node);
+    int Outdegree_(UnitigGraphVertex &vertex, int dir) {
+        return Indegree_(dir == 0 ? vertex.rev_start_node : vertex.start_node);
+    }
+    int Outgoings_(UnitigGraphVertex &vertex, int dir, int64_t *outgoings); // return the outdegree
+    int64_t NextSimplePathStart_(UnitigGraphVertex &vertex, int dir); // -1 if cannot extend
+
+    struct LinearPath {
+        LinearPath(uint32_t vertex_id, int dir): vertex_id(vertex_id), dir(dir) {}
+        uint32_t vertex_id;
+        int dir;
+        std::vector<std::pair<uint32_t, bool> > path; // first: vertex_id, second: is_rc
+        int64_t label_offset;
+        uint32_t label_length;
+    };
 
 private:
     // data
     static const size_t kMaxNumVertices = uint32_t(4294967295ULL); // std::numeric_limits<uint32_t>::max();
+    static const int kBasesPerLabelWord = CompactSequence::kBasesPerWord; // the label arena is packed as CompactSequence
     SuccinctDBG *sdbg_;
-    HashMap<int64_t, uint32_t> start_node_map_;
+    // map a start node of the SdBG to its vertex: start_node_vertex_[rank of the node in is_start_node_]
+    AtomicBitVector is_start_node_;
+    RankAndSelect1Bit start_node_rank_;
+    std::vector<uint32_t> start_node_vertex_;
+    // adjacency in CSR: adj_nodes_[adj_offsets_[r], adj_offsets_[r + 1]) are the start nodes following the end
+    // node which is the reverse complement of the r-th start node, -1 if the successor has been removed
+    std::vector<int64_t> adj_offsets_;
+    std::vector<int64_t> adj_nodes_;
     std::vector<UnitigGraphVertex> vertices_;
+    std::vector<uint64_t> label_arena_;
 };
 
 #endif // UNITIG_GRAPH_H_
\ No newline at end of file